@@ -1,9 +1,14 @@
 #include <iostream>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
 #include <string>
+#include <sstream>
+#include <fstream>
+#include <chrono>
 
-#include<fcntl.h>
-#include<unistd.h>
+#include "simpledb.h"
 
 using namespace std;
 
@@ -13,813 +18,61 @@ enum MetaCommandResult
     META_COMMAND_UNRECOGNIZED_COMMAND
 };
 
-enum PrepareResult
-{
-    PREPARE_SUCCESS,
-    PREPARE_NEGATIVE_ID,
-    PREPARE_STRING_TOO_LONG,
-    PREPARE_SYNTAX_ERROR,
-    PREPARE_UNRECOGNIZED_STATEMENT
-};
-
-enum StatementType
-{
-    STATEMENT_INSERT,
-    STATEMENT_SELECT
-};
-
-enum ExecuteResult
-{
-    EXECUTE_SUCCESS,
-    EXECUTE_TABLE_FULL,
-    EXECUTE_DUPLICATE_KEY
-};
-
-enum NodeType
-{
-    NODE_INTERNAL,
-    NODE_LEAF
-};
-
-#define COLUMN_USERNAME_SIZE 32
-#define COLUMN_EMAIL_SIZE 255
-
-class Row
-{
-public:
-
-    uint32_t id;
-    char username[COLUMN_USERNAME_SIZE + 1];
-    char email[COLUMN_EMAIL_SIZE + 1];
-
-    Row()
-    {
-        id = 0;
-        username[0] = '\0';
-        email[0] = '\0';
-    }
-
-    Row(uint32_t id, const char *username, const char *email)
-    {
-        this->id = id;
-        strncpy(this->username, username, COLUMN_USERNAME_SIZE + 1);
-        strncpy(this->email, email, COLUMN_EMAIL_SIZE + 1);
-    }
-};
-
-#define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
-
-const uint32_t ID_SIZE = size_of_attribute(Row, id);
-const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
-
-void serialize_row(Row &source, void *destination)
-{
-    memcpy((char *)destination + ID_OFFSET, &(source.id), ID_SIZE);
-    memcpy((char *)destination + USERNAME_OFFSET, &(source.username), USERNAME_SIZE);
-    memcpy((char *)destination + EMAIL_OFFSET, &(source.email), EMAIL_SIZE);
-}
-
-void deserialize_row(void *source, Row &destination)
-{
-    memcpy(&(destination.id), (char *)source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination.username), (char *)source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination.email), (char *)source + EMAIL_OFFSET, EMAIL_SIZE);
-}
-
-#define TABLE_MAX_PAGES 100
-const uint32_t PAGE_SIZE = 4096;
-
-// Common Node Header Layout
-const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
-const uint32_t NODE_TYPE_OFFSET = 0;
-const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
-const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
-const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
-const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
-const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
-
-class Node
-{
-protected:
-    void *node;
-public:
-    Node(){}
-    Node(void *node) : node(node){}
-
-    NodeType get_node_type()
-    {
-        uint8_t value = *((uint8_t *)((char *)node + NODE_TYPE_OFFSET));
-        return (NodeType)value;
-    }
-
-    void set_node_type(NodeType type)
-    {
-        *((uint8_t *)((char *)node + NODE_TYPE_OFFSET)) = (uint8_t)type;
-    }
-
-    void *get_node()
-    {
-        return node;
-    }
-
-    bool is_node_root()
-    {
-        uint8_t value = *((uint8_t *)((char *)node + IS_ROOT_OFFSET));
-        return value == 1;
-    }
-
-    void set_node_root(bool is_root)
-    {
-        *((uint8_t *)((char *)node + IS_ROOT_OFFSET)) = is_root ? 1 : 0;
-    }
-
-    virtual uint32_t get_node_max_key();
-};
-
-// Leaf Node Header Layout
-const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE 
-                                    + LEAF_NODE_NUM_CELLS_SIZE
-                                    + LEAF_NODE_NEXT_LEAF_SIZE;
-
-// Leaf Node Body Layout
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
-
-class LeafNode : public Node
-{
-public:
-    LeafNode(){};
-    LeafNode(void *node) : Node(node){}
-
-    void initialize_leaf_node()
-    {
-        set_node_type(NODE_LEAF);
-        set_node_root(false);
-        *leaf_node_num_cells() = 0;
-        *leaf_node_next_leaf() = 0; // 0 = no sibling
-    }
-
-    uint32_t *leaf_node_num_cells()
-    {
-        return (uint32_t *)((char *)node + LEAF_NODE_NUM_CELLS_OFFSET);
-    }
-
-    void *leaf_node_cell(uint32_t cell_num)
-    {
-        return (char *)node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
-    }
-
-    uint32_t *leaf_node_key(uint32_t cell_num)
-    {
-        return (uint32_t *)leaf_node_cell(cell_num);
-    }
-
-    void *leaf_node_value(uint32_t cell_num)
-    {
-        return (char *)leaf_node_cell(cell_num) + LEAF_NODE_KEY_SIZE;
-    }
-
-    uint32_t get_node_max_key() override
-    {
-        return *leaf_node_key(*leaf_node_num_cells() - 1);
-    }
-
-    u_int32_t *leaf_node_next_leaf()
-    {
-        return (u_int32_t *)((char *)node + LEAF_NODE_NEXT_LEAF_OFFSET);
-    }
-
-};
-
-// Internal Node Header Layout
-const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + 
-                                                  INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                           INTERNAL_NODE_NUM_KEYS_SIZE +
-                                           INTERNAL_NODE_RIGHT_CHILD_SIZE;
-
-// Internal Node Body Layout
-const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE +
-                                         INTERNAL_NODE_KEY_SIZE;
-
-class InternalNode : public Node
-{
-public:
-    InternalNode(){};
-    InternalNode(void *node) : Node(node){}
-
-    void initialize_internal_node()
-    {
-        set_node_type(NODE_INTERNAL);
-        set_node_root(false);
-        *internal_node_num_keys() = 0;
-    }
-
-    uint32_t *internal_node_num_keys()
-    {
-        return (uint32_t *)((char *)node + INTERNAL_NODE_NUM_KEYS_OFFSET);
-    }
-
-    uint32_t *internal_node_right_child()
-    {
-        return (uint32_t *)((char *)node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
-    }
-
-    uint32_t *internal_node_cell(uint32_t cell_num)
-    {
-        return (uint32_t *)((char *)node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE);
-    }
-
-    uint32_t *internal_node_child(uint32_t child_num)
-    {
-        uint32_t num_keys = *internal_node_num_keys();
-        if(child_num > num_keys)
-        {
-            cout << "Tried to access child_num " << child_num << " > num_keys " << num_keys << endl;
-            exit(EXIT_FAILURE);
-        }
-        else if(child_num == num_keys)
-        {
-            return internal_node_right_child();
-        }
-        else
-        {
-            return internal_node_cell(child_num);
-        }
-    }
-
-    uint32_t *internal_node_key(uint32_t key_num)
-    {
-        return internal_node_cell(key_num) + INTERNAL_NODE_CHILD_SIZE;
-    }
-
-    uint32_t get_node_max_key() override
-    {
-        return *internal_node_key(*internal_node_num_keys() - 1);
-    }
-};
-
-uint32_t Node::get_node_max_key()
-{
-    if(get_node_type() == NODE_LEAF)
-    {
-        LeafNode *leaf_node = (LeafNode *)this;
-        return *leaf_node->leaf_node_key(*leaf_node->leaf_node_num_cells() - 1);
-    }
-    else
-    {
-        InternalNode *internal_node = (InternalNode *)this;
-        return *internal_node->internal_node_key(*internal_node->internal_node_num_keys() - 1);
-    }
-}
-
-class Pager
-{
-private:
-    int file_descriptor;
-    uint32_t file_length;
-    void *pages[TABLE_MAX_PAGES];
-    uint32_t num_pages;
-
-public:
-    Pager(const char *filename);
-
-    void *get_page(uint32_t page_num);
-    void pager_flush(uint32_t page_num);
-    void print_tree(uint32_t page_num, uint32_t indentation_level);
-    uint32_t get_unused_page_num();
-
-    friend class Table;
-};
-
-Pager::Pager(const char *filename)
-{
-    file_descriptor = open(filename,
-                           O_RDWR |       // Read/Write mode
-                               O_CREAT,   // Create file if it does not exist
-                           S_IWUSR |      // User write permission
-                               S_IRUSR    // User read permission
-    );
-    if(file_descriptor < 0)
-    {
-        cerr << "Error: cannot open file " << filename << endl;
-        exit(EXIT_FAILURE);
-    }
-    file_length = lseek(file_descriptor, 0, SEEK_END);
-    num_pages = file_length / PAGE_SIZE;
-
-    if(file_length % PAGE_SIZE != 0)
-    {
-        cerr << "Db file is not a whole number of pages. Corrupt file." << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    for(uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
-    {
-        pages[i] = nullptr;
-    }
-}
-
-void *Pager::get_page(uint32_t page_num)
-{
-    if(page_num > TABLE_MAX_PAGES)
-    {
-        cout << "Tried to fetch page numbe out of bounds. " << page_num << " > "
-             << TABLE_MAX_PAGES << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    if(pages[page_num] == nullptr)
-    {
-        // Cache miss. Allocate memory and load from file
-        void *page = malloc(PAGE_SIZE);
-        uint32_t num_pages = file_length / PAGE_SIZE;
-
-        // We might save a partial page at the end of the file
-        if(file_length % PAGE_SIZE)
-        {
-            num_pages += 1;
-        }
-
-        if(page_num <= num_pages)
-        {
-            lseek(file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(file_descriptor, page, PAGE_SIZE);
-            if(bytes_read == -1)
-            {
-                cout << "Error reading file: " << errno << endl;
-                exit(EXIT_FAILURE);
-            }
-        }
-
-        pages[page_num] = page;
-
-        if(page_num >= num_pages)
-        {
-            this->num_pages = page_num + 1;
-        }
-    }
-
-    return pages[page_num];
-
-}
-
-void Pager::pager_flush(uint32_t page_num)
-{
-    if(pages[page_num] == nullptr)
-    {
-        cout << "Tried to flush null page" << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    off_t offset = lseek(file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-
-    if(offset == -1)
-    {
-        cout << "Error seeking: " << errno << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    ssize_t bytes_written = write(file_descriptor, pages[page_num], PAGE_SIZE);
-
-    if(bytes_written == -1)
-    {
-        cout << "Error writing: " << errno << endl;
-        exit(EXIT_FAILURE);
-    }
-}
-
-void indent(uint32_t level)
-{
-    for(uint32_t i = 0; i < level; i++)
-    {
-        cout << "  ";
-    }
-}
-
-void Pager::print_tree(uint32_t page_num, uint32_t indentation_level)
-{
-    Node *node = new Node(get_page(page_num));
-    uint32_t num_keys, child;
-
-    switch (node->get_node_type())
-    {
-        case (NODE_LEAF):
-            num_keys = *((LeafNode *)node)->leaf_node_num_cells();
-            indent(indentation_level);
-            cout << "- leaf (size " << num_keys << ")" << endl;
-            for(uint32_t i = 0; i < num_keys; i++)
-            {
-                indent(indentation_level + 1);
-                cout << "- " << *((LeafNode *)node)->leaf_node_key(i) << endl;
-            }
-            break;
-        case (NODE_INTERNAL):
-            num_keys = *((InternalNode *)node)->internal_node_num_keys();
-            indent(indentation_level);
-            cout << "- internal (size " << num_keys << ")" << endl;
-            for(uint32_t i = 0; i < num_keys; i++)
-            {
-                child = *((InternalNode *)node)->internal_node_child(i);
-                print_tree(child, indentation_level + 1);
-
-                indent(indentation_level + 1);
-                cout << "- key " << *((InternalNode *)node)->internal_node_key(i) << endl;
-            }
-            child = *((InternalNode *)node)->internal_node_right_child();
-            print_tree(child, indentation_level + 1);
-            break;
-        
-    }
-}
-
-uint32_t Pager::get_unused_page_num()
-{
-    return num_pages;
-}
-
-class Table;
-class Cursor
-{
-private:
-    Table *table;
-    uint32_t page_num;
-    uint32_t cell_num;
-    bool end_of_table;
-
-public:
-    Cursor(Table *table);
-    Cursor(Table *table, uint32_t page_num, uint32_t key);
-    void *cursor_value();
-    void cursor_advance();
-    void leaf_node_insert(uint32_t key, Row &value);
-    void leaf_node_split_and_insert(uint32_t key, Row &value);
-
-    friend class DB;
-};
-
-class Table
-{
-private:
-    uint32_t root_page_num;
-    Pager pager;
-public:
-    Table(const char *filename) : pager(filename)
-    {
-        root_page_num = 0;
-        if(pager.num_pages == 0)
-        {
-            // New file. Initialize page 0 as leaf node.
-            LeafNode root_node = pager.get_page(0);
-            root_node.initialize_leaf_node();
-            root_node.set_node_root(true);
-        }
-    }
-    Cursor *table_find(uint32_t key);
-    void create_new_root(uint32_t right_child_page_num);
-    Cursor *internal_node_find(uint32_t page_num, uint32_t key);
-    ~Table();
-
-    friend class Cursor;
-    friend class DB;
-};
-
-Cursor::Cursor(Table *table)
-{
-    Cursor *cursor = table->table_find(0);
-    this->table = table;
-    this->page_num = cursor->page_num;
-    this->cell_num = cursor->cell_num;
-
-    LeafNode root_node = table->pager.get_page(cursor->page_num);
-    uint32_t num_cells = *root_node.leaf_node_num_cells();
-
-    this->end_of_table = (num_cells == 0);
-}
-
-Cursor::Cursor(Table *table, uint32_t page_num, uint32_t key)
-{
-    this->table = table;
-    this->page_num = page_num;
-    this->end_of_table = false;
-
-    LeafNode root_node = table->pager.get_page(page_num);
-    uint32_t num_cells = *root_node.leaf_node_num_cells();
-    
-    // Binary Search
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index = num_cells;
-    while(one_past_max_index != min_index)
-    {
-        uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *root_node.leaf_node_key(index);
-        if(key == key_at_index)
-        {
-            this->cell_num = index;
-            return;
-        }
-        if(key < key_at_index)
-        {
-            one_past_max_index = index;
-        }
-        else
-        {
-            min_index = index + 1;
-        }
-    }
-
-    this->cell_num = min_index;
-}
-
-void *Cursor::cursor_value()
-{
-    void *page = table->pager.get_page(page_num);
-
-    return LeafNode(page).leaf_node_value(cell_num);
-}
-
-void Cursor::cursor_advance()
-{
-    LeafNode leaf_node = table->pager.get_page(page_num);
-    cell_num += 1;
-    if(cell_num >= *leaf_node.leaf_node_num_cells())
-    {
-        // advance to next leaf node
-        uint32_t next_page_num = *leaf_node.leaf_node_next_leaf();
-        if(next_page_num == 0)
-        {
-            // this was right most leaf
-            end_of_table = true;
-        }
-        else
-        {
-            page_num = next_page_num;
-            cell_num = 0;
-        }
-    }
-}
-
-void Cursor::leaf_node_insert(uint32_t key, Row &value)
-{
-    LeafNode leaf_node = table->pager.get_page(page_num);
-    uint32_t num_cells = *leaf_node.leaf_node_num_cells();
-
-    if(num_cells >= LEAF_NODE_MAX_CELLS)
-    {
-        // Node full
-        leaf_node_split_and_insert(key, value);
-        return;
-    }
-
-    if(cell_num < num_cells)
-    {
-        //make room for new cell
-        for(uint32_t i = num_cells; i > cell_num; i--)
-        {
-            memcpy(leaf_node.leaf_node_cell(i), leaf_node.leaf_node_cell(i - 1),
-                    LEAF_NODE_CELL_SIZE);
-        }
-    }
-
-    // insert new cell
-    *(leaf_node.leaf_node_num_cells()) += 1;
-    *(leaf_node.leaf_node_key(cell_num)) = key;
-    serialize_row(value, leaf_node.leaf_node_value(cell_num));
-}
-
-void Cursor::leaf_node_split_and_insert(uint32_t key, Row &value)
-{
-    /* 
-    Create a new node and move half the cells over,
-    Insert the new value in one of the two nodes.
-    Update parent or create a new parent.
-    */
-
-    LeafNode old_node = table->pager.get_page(page_num);
-    uint32_t new_page_num = table->pager.get_unused_page_num();
-    LeafNode new_node = table->pager.get_page(new_page_num);
-    new_node.initialize_leaf_node();
-    *new_node.leaf_node_next_leaf() = *old_node.leaf_node_next_leaf();
-    *old_node.leaf_node_next_leaf() = new_page_num;
-
-    /*
-    All existing keys plus new key should be divided
-    evenly between old(left) and new(right) nodes.
-    Starting from the right, move each key to correct position.
-    */
-
-    for(int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--)
-    {
-        LeafNode destination_node;
-        if(i >= LEAF_NODE_LEFT_SPLIT_COUNT)
-        {
-            destination_node = new_node;
-        }
-        else
-        {
-            destination_node = old_node;
-        }
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        LeafNode destination = destination_node.leaf_node_cell(index_within_node);
-
-        if(i == cell_num)
-        {
-            serialize_row(value, 
-                          destination_node.leaf_node_value(index_within_node));
-            *destination_node.leaf_node_key(index_within_node) = key;
-        }
-        else if(i > cell_num)
-        {
-            memcpy(destination.get_node(), old_node.leaf_node_cell(i - 1), LEAF_NODE_CELL_SIZE);
-        }
-        else
-        {
-            memcpy(destination.get_node(), old_node.leaf_node_cell(i), LEAF_NODE_CELL_SIZE);
-        }
-    }
-
-    /* Update cell count on both leaf nodes */
-    *old_node.leaf_node_num_cells() = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *new_node.leaf_node_num_cells() = LEAF_NODE_RIGHT_SPLIT_COUNT;
-
-    if(old_node.is_node_root())
-    {
-        return table->create_new_root(new_page_num);
-    }
-    else
-    {
-        cout << "Need to implement updating parent after split" << endl;
-        exit(EXIT_FAILURE);
-    }
-
-}
-
-Cursor *Table::table_find(uint32_t key)
-{
-    LeafNode root_node = pager.get_page(root_page_num);
+#define BATCH_IO_BUFFER_SIZE (1 << 20)   // stdin/stdout buffers in batch mode
+#define DEFAULT_SLOW_QUERY_MS 100        // .slowlog threshold when none is given
+#define MAX_CACHE_PAGES (1 << 20)        // --cache-pages limit, 4 GiB of frames
 
-    if(root_node.get_node_type() == NODE_LEAF)
-    {
-        return new Cursor(this, root_page_num, key);
-    }
-    else
-    {
-        return internal_node_find(root_page_num, key);
-    }
-}
-
-void Table::create_new_root(uint32_t right_child_page_num)
+class DB
 {
     /*
-    Handle splitting the root.
-    Old root copied to new page, becomes left child.
-    Address of right child passed in.
-    Re-initialize root page to contain the new root node.
-    New root node points to two children.
+    The interactive shell: reads statements and meta commands from
+    stdin and runs them against a Database.
     */
+private:
+    Database *database;
+    bool batch;   // no prompt or status lines, output flushed at exit
 
-   InternalNode root = pager.get_page(root_page_num);
-   Node right_child = pager.get_page(right_child_page_num);
-   uint32_t left_child_page_num = pager.get_unused_page_num();
-   Node left_child = pager.get_page(left_child_page_num);
-
-   // Left child has data copied from old root
-   memcpy(left_child.get_node(), root.get_node(), PAGE_SIZE);
-   left_child.set_node_root(false);
-
-   // Root node is a new internal node with one key and two children
-   root.initialize_internal_node();
-   root.set_node_root(true);
-   *root.internal_node_num_keys() = 1;
-   *root.internal_node_child(0) = left_child_page_num;
-   uint32_t left_child_max_key = left_child.get_node_max_key();
-   *root.internal_node_key(0) = left_child_max_key;
-   *root.internal_node_right_child() = right_child_page_num;
-}
-
-Cursor *Table::internal_node_find(uint32_t page_num, uint32_t key)
-{
-    InternalNode node = pager.get_page(page_num);
-    uint32_t num_keys = *node.internal_node_num_keys();
-
-    //Binary search to find index of child to search
-    uint32_t min_index = 0;
-    uint32_t max_index = num_keys; // there is 1 more child than key
-
-    while(max_index != min_index)
-    {
-        uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *node.internal_node_key(index);
-        if(key_to_right >= key)
-        {
-            max_index = index;
-        }
-        else
-        {
-            min_index = index + 1;
-        }
-    }
-    uint32_t child_num = *node.internal_node_child(min_index);
-    Node child = pager.get_page(child_num);
-    switch(child.get_node_type())
-    {
-        case NODE_INTERNAL:
-            return internal_node_find(child_num, key);
-        case NODE_LEAF: default:
-            return new Cursor(this, child_num, key);
-    }
-}
-
-Table::~Table()
-{
-    for(uint32_t i = 0; i < pager.num_pages; i++)
-    {
-        if(pager.pages[i] == nullptr)
-        {
-            continue;
-        }
-        pager.pager_flush(i);
-        free(pager.pages[i]);
-        pager.pages[i] = nullptr;
-    }
-    
-    int result = close(pager.file_descriptor);
-    if(result == -1)
-    {
-        cout << "Error closing db file." << endl;
-        exit(EXIT_FAILURE);
-    }
-    for(uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
-    {
-        void *page = pager.pages[i];
-        if(page)
-        {
-            free(page);
-            pager.pages[i] = nullptr;
-        }
-    }
-}
-
-class Statement
-{
-public:
-    StatementType type;
-    Row row_to_insert;
-};
+    // .timer on prints the time of each statement; .slowlog writes the
+    // statements that took at least slow_query_ms to slow_log. With
+    // both off statements are not timed at all
+    bool timer;
+    ofstream slow_log;
+    double slow_query_ms;
 
-class DB
-{
-private:
-    Table *table;
+    void update_timing();
+    void report_timing(const string &inputLine, chrono::steady_clock::time_point start,
+                       chrono::steady_clock::time_point parsed, Stats &before);
 
 public:
-    DB(const char *filename)
+    DB(const char *filename, uint32_t pool_size, PagerBackend backend, bool compress)
     {
-        table = new Table(filename);
+        database = new Database(filename, pool_size, backend, compress);
+        batch = false;
+        timer = false;
+        slow_query_ms = DEFAULT_SLOW_QUERY_MS;
     }
-    void start();
+    void start(bool batch);
     void print_prompt();
 
     bool parse_meta_command(string &command);
     MetaCommandResult do_meta_command(string &command);
+    void import_rows(const string &filename, uint32_t fill_percent);
 
-    PrepareResult prepare_insert(string &inputLine, Statement &statement);
-    PrepareResult prepare_statement(string &inputLine, Statement &statement);
     bool parse_statement(string &inputLine, Statement &statement);
     void execute_statement(Statement &statement);
-    ExecuteResult execute_insert(Statement &statement);
-    ExecuteResult execute_select(Statement &statement);
 
     ~DB()
     {
-        delete table;
+        delete database;
     }
 };
 
 void DB::print_prompt()
 {
-    cout << "db > ";
+    if(!batch)
+    {
+        cout << "db > ";
+    }
 }
 
 bool DB::parse_meta_command(string &command)
@@ -844,82 +97,139 @@ MetaCommandResult DB::do_meta_command(string &command)
 {
     if (command == ".exit")
     {
-        delete(table);
-        cout << "Bye!" << endl;
+        delete(database);
+        if(!batch)
+        {
+            cout << "Bye!" << endl;
+        }
         exit(EXIT_SUCCESS);
     }
     else if(command == ".btree")
     {
         cout << "Tree:" << endl;
-        LeafNode root_node = table->pager.get_page(table->root_page_num);
-        table->pager.print_tree(0, 0);
+        database->print_tree();
         return META_COMMAND_SUCCESS;
     }
-    else if(command == ".constants")
+    else if(command == ".checkpoint")
     {
-        cout << "Constants:" << endl;
-        cout << "ROW_SIZE: " << ROW_SIZE << endl;
-        cout << "COMMON_NODE_HEADER_SIZE: " << COMMON_NODE_HEADER_SIZE << endl;
-        cout << "LEAF_NODE_HEADER_SIZE: " << LEAF_NODE_HEADER_SIZE << endl;
-        cout << "LEAF_NODE_CELL_SIZE: " << LEAF_NODE_CELL_SIZE << endl;
-        cout << "LEAF_NODE_SPACE_FOR_CELLS: " << LEAF_NODE_SPACE_FOR_CELLS << endl;
-        cout << "LEAF_NODE_MAX_CELLS: " << LEAF_NODE_MAX_CELLS << endl;
+        database->checkpoint();
         return META_COMMAND_SUCCESS;
     }
-    else
+    else if(command == ".vacuum")
     {
-        return META_COMMAND_UNRECOGNIZED_COMMAND;
+        database->vacuum();
+        return META_COMMAND_SUCCESS;
     }
-}
-
-PrepareResult DB::prepare_insert(string &inputLine, Statement &statement)
-{
-    statement.type = STATEMENT_INSERT;
-
-    char *insert_line = (char *) inputLine.c_str();
-    char *keyword = strtok(insert_line, " ");
-    char *id_string = strtok(NULL, " ");
-    char *username = strtok(NULL, " ");
-    char *email = strtok(NULL, " ");
-
-    if(id_string == NULL || username == NULL || email == NULL)
+    else if(!command.compare(0, 8, ".import "))
     {
-        return PREPARE_SYNTAX_ERROR;
+        istringstream arguments(command.substr(8));
+        string filename;
+        int fill_percent = 100;
+        arguments >> filename;
+        if(!(arguments >> fill_percent))
+        {
+            fill_percent = 100;
+        }
+        if(filename.empty() || fill_percent < 1 || fill_percent > 100)
+        {
+            cout << "Usage: .import <file> [fill percent 1-100]" << endl;
+            return META_COMMAND_SUCCESS;
+        }
+        import_rows(filename, fill_percent);
+        return META_COMMAND_SUCCESS;
+    }
+    else if(command == ".stats")
+    {
+        Stats stats;
+        database->stats(stats);
+        cout << "Stats:" << endl;
+        cout << "cache_hits: " << stats.cache_hits << endl;
+        cout << "cache_misses: " << stats.cache_misses << endl;
+        cout << "pages_read: " << stats.pages_read << endl;
+        cout << "pages_read_ahead: " << stats.pages_read_ahead << endl;
+        cout << "pages_written: " << stats.pages_written << endl;
+        cout << "pages_flushed: " << stats.pages_flushed << endl;
+        cout << "pages_logged: " << stats.pages_logged << endl;
+        cout << "bytes_read: " << stats.bytes_read << endl;
+        cout << "bytes_written: " << stats.bytes_written << endl;
+        cout << "leaf_splits: " << stats.leaf_splits << endl;
+        cout << "internal_splits: " << stats.internal_splits << endl;
+        cout << "root_splits: " << stats.root_splits << endl;
+        cout << "rows_examined: " << stats.rows_examined << endl;
+        cout << "io_nanoseconds: " << stats.io_nanoseconds << endl;
+        cout << "tree_height: " << stats.tree_height << endl;
+        cout << "page_count: " << stats.page_count << endl;
+        cout << "leaf_count: " << stats.leaf_count << endl;
+        cout << "row_count: " << stats.row_count << endl;
+        printf("leaf_fill_percent: %.1f\n", stats.leaf_fill_percent);
+        return META_COMMAND_SUCCESS;
     }
-    int id = atoi(id_string);
-    if(id < 0)
+    else if(command == ".timer on" || command == ".timer off")
     {
-        return PREPARE_NEGATIVE_ID;
+        timer = command == ".timer on";
+        update_timing();
+        return META_COMMAND_SUCCESS;
     }
-    if(strlen(username) > COLUMN_USERNAME_SIZE)
+    else if(command == ".slowlog off")
     {
-        return PREPARE_STRING_TOO_LONG;
+        slow_log.close();
+        update_timing();
+        return META_COMMAND_SUCCESS;
     }
-    if(strlen(email) > COLUMN_EMAIL_SIZE)
+    else if(!command.compare(0, 9, ".slowlog "))
     {
-        return PREPARE_STRING_TOO_LONG;
+        istringstream arguments(command.substr(9));
+        string filename;
+        double threshold_ms = DEFAULT_SLOW_QUERY_MS;
+        arguments >> filename;
+        if(!(arguments >> threshold_ms))
+        {
+            threshold_ms = DEFAULT_SLOW_QUERY_MS;
+        }
+        if(filename.empty() || threshold_ms < 0)
+        {
+            cout << "Usage: .slowlog <file> [threshold ms] | .slowlog off" << endl;
+            return META_COMMAND_SUCCESS;
+        }
+        slow_log.close();
+        slow_log.clear();
+        slow_log.open(filename, ios::out | ios::app);
+        if(!slow_log.is_open())
+        {
+            cout << "Error: cannot open file " << filename << endl;
+        }
+        slow_query_ms = threshold_ms;
+        update_timing();
+        return META_COMMAND_SUCCESS;
+    }
+    else if(command == ".constants")
+    {
+        cout << "Constants:" << endl;
+        Database::print_constants();
+        return META_COMMAND_SUCCESS;
+    }
+    else
+    {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
     }
-    statement.row_to_insert = Row(id, username, email);
-
-    return PREPARE_SUCCESS;
-
 }
 
-PrepareResult DB::prepare_statement(string &inputLine, Statement &statement)
+void DB::import_rows(const string &filename, uint32_t fill_percent)
 {
-    if(!inputLine.compare(0, 6, "insert"))
-    {
-        return prepare_insert(inputLine, statement);
-    }
-    else if(!inputLine.compare(0, 6, "select"))
+    if(!database->is_empty())
     {
-        statement.type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+        cout << "Error: .import requires an empty table." << endl;
+        return;
     }
-    else
+
+    uint32_t num_rows;
+    string error;
+    if(!database->import_file(filename, fill_percent, num_rows, error))
     {
-        return PREPARE_UNRECOGNIZED_STATEMENT;
+        cout << "Error: " << error << endl;
+        return;
     }
+    cout << "Imported " << num_rows << " rows." << endl;
 }
 
 bool DB::parse_statement(string &inputLine, Statement &statement)
@@ -927,6 +237,11 @@ bool DB::parse_statement(string &inputLine, Statement &statement)
     switch(prepare_statement(inputLine, statement))
     {
         case PREPARE_SUCCESS:
+            if(statement.param_count() > 0)
+            {
+                cout << "Placeholders can only be used through the library." << endl;
+                return true;
+            }
             return false;
         case PREPARE_NEGATIVE_ID:
             cout << "ID must be positive." << endl;
@@ -944,64 +259,38 @@ bool DB::parse_statement(string &inputLine, Statement &statement)
     return false;
 }
 
-ExecuteResult DB::execute_insert(Statement &statement)
+void DB::execute_statement(Statement &statement)
 {
-    LeafNode leaf_node = table->pager.get_page(table->root_page_num);
-    uint32_t num_cells = *leaf_node.leaf_node_num_cells();
-
-    Cursor *cursor = table->table_find(statement.row_to_insert.id);
-
-    if(cursor->cell_num < num_cells)
+    if(statement.aggregate != AGGREGATE_NONE)
     {
-        uint32_t key_at_index = *leaf_node.leaf_node_key(cursor->cell_num);
-        if(key_at_index == statement.row_to_insert.id)
+        uint64_t value;
+        if(database->aggregate(statement, value))
         {
-            return EXECUTE_DUPLICATE_KEY;
+            cout << value << "\n";
         }
+        else
+        {
+            cout << "NULL" << "\n";
+        }
+        if(!batch)
+        {
+            cout << "Executed." << "\n";
+        }
+        return;
     }
 
-    cursor->leaf_node_insert(statement.row_to_insert.id, statement.row_to_insert);
-
-    delete cursor;
-
-    return EXECUTE_SUCCESS;
-}
-
-ExecuteResult DB::execute_select(Statement &statement)
-{
-    // start of the table
-    Cursor *cursor = new Cursor(table);
-
-    Row row;
-    while(!cursor->end_of_table)
-    {
-        deserialize_row(cursor->cursor_value(), row);
-        cout << "(" << row.id << ", " << row.username << ", " << row.email << ")" << endl;
-        cursor->cursor_advance();
-    }
-
-    delete cursor;
-
-    return EXECUTE_SUCCESS;
-}
-
-void DB::execute_statement(Statement &statement)
-{
-    ExecuteResult result;
-    switch (statement.type)
-    {
-        case STATEMENT_INSERT:
-            result = execute_insert(statement);
-            break;
-        case STATEMENT_SELECT:
-            result = execute_select(statement);
-            break;
-    }
+    ExecuteResult result = database->execute(statement, [](const RowView &row) {
+        cout << "(" << row.id() << ", " << row.username() << ", " << row.email() << ")" << "\n";
+        return true;
+    });
 
     switch (result)
     {
         case EXECUTE_SUCCESS:
-            cout << "Executed." << endl;
+            if(!batch)
+            {
+                cout << "Executed." << "\n";
+            }
             break;
         case (EXECUTE_DUPLICATE_KEY):
             cout << "Error: Duplicate key." << endl;
@@ -1009,23 +298,102 @@ void DB::execute_statement(Statement &statement)
         case EXECUTE_TABLE_FULL:
             cout << "Error: Table full." << endl;
             break;
+        case EXECUTE_STRING_TOO_LONG:
+            cout << "String is too long." << endl;
+            break;
+        case EXECUTE_INDEX_EXISTS:
+            cout << "Error: Index already exists." << endl;
+            break;
+        case EXECUTE_NOT_FOUND:
+            cout << "Error: No row with that id." << endl;
+            break;
+        case EXECUTE_AGGREGATE:
+            cout << "Error: Aggregates run through aggregate()." << endl;
+            break;
     }
 }
 
-void DB::start()
+void DB::update_timing()
+{
+    // The pager times its I/O only while some statement timing needs it
+    database->set_timing(timer || slow_log.is_open());
+}
+
+void DB::report_timing(const string &inputLine, chrono::steady_clock::time_point start,
+                       chrono::steady_clock::time_point parsed, Stats &before)
 {
+    /*
+    Print and log the time a statement took, from the counters taken
+    before it was parsed. Execution includes formatting the rows it
+    printed and all of its page I/O: reads on cache misses, evictions,
+    and the log write and sync of its commit. The mmap backend reads
+    pages through page faults, which are neither timed nor counted.
+    */
+    auto end = chrono::steady_clock::now();
+    Stats after;
+    database->counters(after);
+    double total_ms = chrono::duration<double, milli>(end - start).count();
+    double parse_ms = chrono::duration<double, milli>(parsed - start).count();
+    double io_ms = (after.io_nanoseconds - before.io_nanoseconds) / 1e6;
+
+    if(timer)
+    {
+        printf("Run Time: %.3f ms (parse %.3f ms, execute %.3f ms, of which I/O %.3f ms)\n",
+               total_ms, parse_ms, total_ms - parse_ms, io_ms);
+    }
+    if(slow_log.is_open() && total_ms >= slow_query_ms)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "%.3f ms, I/O %.3f ms, %lu page misses, %lu rows examined: ",
+                 total_ms, io_ms, (unsigned long)(after.cache_misses - before.cache_misses),
+                 (unsigned long)(after.rows_examined - before.rows_examined));
+        slow_log << line << inputLine << endl;
+    }
+}
+
+void DB::start(bool batch)
+{
+    /*
+    Read and run statements until .exit or the end of input. Rows are
+    written without flushing; interactively the output is flushed when
+    the next line is read, in batch mode only when the buffer fills or
+    at exit.
+    */
+    this->batch = batch;
+    if(batch)
+    {
+        static char input_buffer[BATCH_IO_BUFFER_SIZE];
+        static char output_buffer[BATCH_IO_BUFFER_SIZE];
+        setvbuf(stdin, input_buffer, _IOFBF, BATCH_IO_BUFFER_SIZE);
+        setvbuf(stdout, output_buffer, _IOFBF, BATCH_IO_BUFFER_SIZE);
+        cin.tie(nullptr);
+    }
+
     while (true)
     {
         print_prompt();
 
         string inputLine;
-        getline(cin, inputLine);
+        if(!getline(cin, inputLine))
+        {
+            inputLine = ".exit";
+        }
 
         if(parse_meta_command(inputLine))
         {
             continue;
         }
 
+        // Only read the clock and counters when something reports them
+        bool timed = timer || slow_log.is_open();
+        Stats before;
+        chrono::steady_clock::time_point start, parsed;
+        if(timed)
+        {
+            database->counters(before);
+            start = chrono::steady_clock::now();
+        }
+
         Statement statement;
 
         if(parse_statement(inputLine, statement))
@@ -1033,7 +401,15 @@ void DB::start()
             continue;
         }
 
+        if(timed)
+        {
+            parsed = chrono::steady_clock::now();
+        }
         execute_statement(statement);
+        if(timed)
+        {
+            report_timing(inputLine, start, parsed, before);
+        }
     }
 }
 
@@ -1045,6 +421,56 @@ int main(int argc, char const *argv[])
         exit(EXIT_FAILURE);
     }
 
-    DB db(argv[1]);
-    db.start();
+    uint32_t pool_size = DEFAULT_POOL_SIZE;
+    string key_search = "auto";
+    PagerBackend backend = PAGER_BUFFER_POOL;
+    bool compress = false;
+    bool batch = false;
+    for(int i = 2; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--cache-pages") && i + 1 < argc)
+        {
+            // Digits only, so a sign or trailing junk is refused rather
+            // than wrapped or dropped
+            const char *value = argv[++i];
+            char *end;
+            unsigned long pages = strtoul(value, &end, 10);
+            if(!isdigit((unsigned char)value[0]) || *end != '\0' || pages > MAX_CACHE_PAGES)
+            {
+                cout << "Unsupported cache size: " << value << endl;
+                exit(EXIT_FAILURE);
+            }
+            pool_size = pages;
+        }
+        else if(!strcmp(argv[i], "--mmap"))
+        {
+            backend = PAGER_MMAP;
+        }
+        else if(!strcmp(argv[i], "--compress"))
+        {
+            compress = true;
+        }
+        else if(!strcmp(argv[i], "--batch"))
+        {
+            batch = true;
+        }
+        else if(!strcmp(argv[i], "--key-search") && i + 1 < argc)
+        {
+            key_search = argv[++i];
+        }
+        else
+        {
+            cout << "Unrecognized option: " << argv[i] << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(!select_key_search(key_search))
+    {
+        cout << "Unsupported key search: " << key_search << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    DB db(argv[1], pool_size, backend, compress);
+    db.start(batch);
 }
\ No newline at end of file
@@ -0,0 +1,413 @@
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include<fcntl.h>
+#include<unistd.h>
+
+#include "simpledb.h"
+
+using namespace std;
+
+/*
+Benchmarks the engine through the embeddable Database API, so the shell's
+parsing and printing stay out of the numbers. Each benchmark prints one
+CSV line with its throughput and latency percentiles:
+
+  ./db_bench [--db FILE] [--rows N] [--ops N] [--threads N]
+             [--cache-pages N] [--mmap] [--compress]
+             [--range-rows N] [--read-percent N] [--scans N]
+             [--benchmarks fillseq,fillrandom,readrandom,readseq,scanrange,readwrite,readcold]
+
+fillseq and fillrandom start from an empty file and insert --rows rows,
+one commit each. The other benchmarks load --rows rows first unless a
+fill benchmark ran before them, then run --ops operations split over
+--threads threads. readcold instead runs once for 1, 2, 4 and so on up
+to --threads threads, each time reopening the file with an empty pool
+and asking the kernel to drop its cached pages, so every line shows
+random reads that miss the cache and how they scale with readers. The
+file is deleted at the end.
+*/
+
+#define DEFAULT_BENCHMARKS "fillseq,fillrandom,readrandom,readseq,scanrange,readwrite,readcold"
+#define HISTOGRAM_SUB_BUCKETS 16   // buckets per power of two of nanoseconds
+
+class Histogram
+{
+    /*
+    Operation latencies in nanoseconds. Each power of two is split into
+    HISTOGRAM_SUB_BUCKETS buckets, so a percentile is reported as the
+    upper end of its bucket, within about 6% of the real value.
+    */
+private:
+    vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t max_ns;
+
+    static uint32_t bucket_of(uint64_t ns)
+    {
+        if(ns < HISTOGRAM_SUB_BUCKETS)
+        {
+            return ns;
+        }
+        uint32_t exponent = 63 - __builtin_clzll(ns);   // at least 4
+        return (exponent - 3) * HISTOGRAM_SUB_BUCKETS + ((ns >> (exponent - 4)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    }
+
+    static uint64_t bucket_upper_bound(uint32_t bucket)
+    {
+        if(bucket < HISTOGRAM_SUB_BUCKETS)
+        {
+            return bucket;
+        }
+        uint32_t exponent = bucket / HISTOGRAM_SUB_BUCKETS + 3;
+        uint64_t sub_bucket = bucket % HISTOGRAM_SUB_BUCKETS;
+        return ((HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << (exponent - 4)) - 1;
+    }
+
+public:
+    Histogram()
+    {
+        buckets.resize(bucket_of(UINT64_MAX) + 1);
+        count = 0;
+        max_ns = 0;
+    }
+
+    void add(uint64_t ns)
+    {
+        buckets[bucket_of(ns)]++;
+        count++;
+        max_ns = max(max_ns, ns);
+    }
+
+    void merge(Histogram &other)
+    {
+        for(uint32_t i = 0; i < buckets.size(); i++)
+        {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        max_ns = max(max_ns, other.max_ns);
+    }
+
+    uint64_t percentile(double fraction)
+    {
+        // The latency that the given fraction of operations stayed within
+        uint64_t target = max((uint64_t)1, (uint64_t)(fraction * count + 0.5));
+        uint64_t seen = 0;
+        for(uint32_t i = 0; i < buckets.size(); i++)
+        {
+            seen += buckets[i];
+            if(seen >= target)
+            {
+                return min(bucket_upper_bound(i), max_ns);
+            }
+        }
+        return max_ns;
+    }
+
+    uint64_t maximum()
+    {
+        return max_ns;
+    }
+};
+
+class Bench
+{
+private:
+    string filename;
+    uint32_t rows;
+    uint32_t ops;
+    uint32_t threads;
+    uint32_t pool_size;
+    PagerBackend backend;
+    bool compress;
+    uint32_t range_rows;
+    uint32_t read_percent;
+    uint32_t scans;
+    unique_ptr<Database> database;
+
+    void open(bool fresh);
+    void drop_file_cache();
+    void ensure_loaded();
+    void run(const string &name, uint32_t num_ops, uint32_t num_threads,
+             function<void(uint32_t, uint32_t, mt19937 &)> op);
+
+public:
+    Bench()
+    {
+        filename = "bench.db";
+        rows = 100000;
+        ops = 100000;
+        threads = 1;
+        pool_size = DEFAULT_POOL_SIZE;
+        backend = PAGER_BUFFER_POOL;
+        compress = false;
+        range_rows = 100;
+        read_percent = 90;
+        scans = 10;
+    }
+
+    bool parse_options(int argc, char const *argv[], string &benchmarks);
+    bool run_benchmark(const string &name);
+    void close();
+};
+
+bool Bench::parse_options(int argc, char const *argv[], string &benchmarks)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        string option = argv[i];
+        bool has_value = i + 1 < argc;
+        if(option == "--mmap")
+        {
+            backend = PAGER_MMAP;
+        }
+        else if(option == "--compress")
+        {
+            compress = true;
+        }
+        else if(option == "--db" && has_value)
+        {
+            filename = argv[++i];
+        }
+        else if(option == "--benchmarks" && has_value)
+        {
+            benchmarks = argv[++i];
+        }
+        else if(has_value && (option == "--rows" || option == "--ops" || option == "--threads" ||
+                              option == "--cache-pages" || option == "--range-rows" ||
+                              option == "--read-percent" || option == "--scans"))
+        {
+            uint32_t value = strtoul(argv[++i], nullptr, 10);
+            uint32_t *target = option == "--rows" ? &rows : option == "--ops" ? &ops :
+                               option == "--threads" ? &threads : option == "--cache-pages" ? &pool_size :
+                               option == "--range-rows" ? &range_rows :
+                               option == "--read-percent" ? &read_percent : &scans;
+            *target = value;
+        }
+        else
+        {
+            cout << "Unrecognized option: " << option << endl;
+            return false;
+        }
+    }
+    threads = max(1u, threads);
+    rows = max(1u, rows);
+    range_rows = max(1u, range_rows);
+    read_percent = min(100u, read_percent);
+    return true;
+}
+
+void Bench::open(bool fresh)
+{
+    database.reset();
+    if(fresh)
+    {
+        remove(filename.c_str());
+        remove((filename + "-wal").c_str());
+    }
+    database.reset(new Database(filename.c_str(), pool_size, backend, compress));
+}
+
+void Bench::drop_file_cache()
+{
+    // Only clean pages are dropped, so the file is closed, and with it
+    // checkpointed, first
+    database.reset();
+    int file_descriptor = ::open(filename.c_str(), O_RDONLY);
+    if(file_descriptor != -1)
+    {
+        posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(file_descriptor);
+    }
+    open(false);
+}
+
+void Bench::close()
+{
+    database.reset();
+    remove(filename.c_str());
+    remove((filename + "-wal").c_str());
+}
+
+void Bench::ensure_loaded()
+{
+    // Read benchmarks need rows; load them untimed in one bulk insert,
+    // into a new file unless a fill benchmark just made one
+    if(database == nullptr)
+    {
+        open(true);
+    }
+    if(!database->is_empty())
+    {
+        return;
+    }
+    vector<Row> batch;
+    for(uint32_t id = 0; id < rows; id++)
+    {
+        string username = "user" + to_string(id);
+        string email = "person" + to_string(id) + "@example.com";
+        batch.emplace_back(id, username.c_str(), email.c_str());
+    }
+    database->put_many(batch);
+    database->checkpoint();
+}
+
+void Bench::run(const string &name, uint32_t num_ops, uint32_t num_threads,
+                function<void(uint32_t, uint32_t, mt19937 &)> op)
+{
+    /*
+    Run num_ops calls of op(thread, op number, generator) spread over
+    num_threads threads, timing each one, and print the CSV line.
+    */
+    vector<Histogram> histograms(num_threads);
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for(uint32_t t = 0; t < num_threads; t++)
+    {
+        workers.emplace_back([&, t] {
+            mt19937 generator(301 + t);
+            for(uint32_t i = t; i < num_ops; i += num_threads)
+            {
+                auto op_start = chrono::steady_clock::now();
+                op(t, i, generator);
+                auto op_end = chrono::steady_clock::now();
+                histograms[t].add(chrono::duration_cast<chrono::nanoseconds>(op_end - op_start).count());
+            }
+        });
+    }
+    for(thread &worker : workers)
+    {
+        worker.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    Histogram total;
+    for(Histogram &histogram : histograms)
+    {
+        total.merge(histogram);
+    }
+    printf("%s,%u,%u,%u,%.4f,%.1f,%.2f,%.2f,%.2f,%.2f\n", name.c_str(), rows, num_ops, num_threads, seconds,
+           num_ops / seconds, total.percentile(0.50) / 1e3, total.percentile(0.99) / 1e3,
+           total.percentile(0.999) / 1e3, total.maximum() / 1e3);
+    fflush(stdout);
+}
+
+bool Bench::run_benchmark(const string &name)
+{
+    if(name == "fillseq" || name == "fillrandom")
+    {
+        vector<uint32_t> ids(rows);
+        for(uint32_t i = 0; i < rows; i++)
+        {
+            ids[i] = i;
+        }
+        if(name == "fillrandom")
+        {
+            shuffle(ids.begin(), ids.end(), mt19937(17));
+        }
+        open(true);
+        run(name, rows, threads, [this, &ids](uint32_t, uint32_t i, mt19937 &) {
+            uint32_t id = ids[i];
+            database->put(id, "user" + to_string(id), "person" + to_string(id) + "@example.com");
+        });
+        return true;
+    }
+
+    ensure_loaded();
+    if(name == "readrandom")
+    {
+        run(name, ops, threads, [this](uint32_t, uint32_t, mt19937 &generator) {
+            Row row;
+            database->get(generator() % rows, row);
+        });
+    }
+    else if(name == "readseq")
+    {
+        // One operation is a full scan
+        run(name, scans, threads, [this](uint32_t, uint32_t, mt19937 &) {
+            uint64_t total = 0;
+            database->scan(0, UINT32_MAX, [&total](const RowView &row) {
+                total += row.id();
+                return true;
+            });
+        });
+    }
+    else if(name == "scanrange")
+    {
+        run(name, ops, threads, [this](uint32_t, uint32_t, mt19937 &generator) {
+            uint32_t remaining = range_rows;
+            database->scan(generator() % rows, UINT32_MAX, [&remaining](const RowView &) {
+                return --remaining > 0;
+            });
+        });
+    }
+    else if(name == "readcold")
+    {
+        for(uint32_t num_threads = 1; ; num_threads = min(2 * num_threads, threads))
+        {
+            drop_file_cache();
+            run(name, ops, num_threads, [this](uint32_t, uint32_t, mt19937 &generator) {
+                Row row;
+                database->get(generator() % rows, row);
+            });
+            if(num_threads == threads)
+            {
+                break;
+            }
+        }
+    }
+    else if(name == "readwrite")
+    {
+        // Reads and same-length updates of random rows, read_percent reads
+        run(name, ops, threads, [this](uint32_t, uint32_t, mt19937 &generator) {
+            uint32_t id = generator() % rows;
+            if(generator() % 100 < read_percent)
+            {
+                Row row;
+                database->get(id, row);
+            }
+            else
+            {
+                database->update(id, "USER" + to_string(id), "person" + to_string(id) + "@example.com");
+            }
+        });
+    }
+    else
+    {
+        cout << "Unknown benchmark: " << name << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char const *argv[])
+{
+    Bench bench;
+    string benchmarks = DEFAULT_BENCHMARKS;
+    if(!bench.parse_options(argc, argv, benchmarks))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    printf("benchmark,rows,ops,threads,seconds,ops_per_sec,p50_us,p99_us,p999_us,max_us\n");
+    istringstream names(benchmarks);
+    string name;
+    bool ok = true;
+    while(ok && getline(names, name, ','))
+    {
+        ok = bench.run_benchmark(name);
+    }
+    bench.close();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,12 +1,12 @@
 describe "database" do
 
     before do
-        `rm -rf test.db`
+        `rm -rf test.db test.db-wal`
     end
 
-    def run_script(commands)
+    def run_script(commands, options = "")
         raw_output = nil
-        IO.popen("./db test.db", "r+") do |pipe|
+        IO.popen("./db test.db #{options}", "r+") do |pipe|
             commands.each do |command|
                 begin
                     pipe.puts command
@@ -23,6 +23,11 @@ describe "database" do
         raw_output.split("\n")
     end
 
+    # rows this wide fill a leaf after 14 cells
+    def long_email(i)
+        "person#{i}@example.com".ljust(255, "x")
+    end
+
     # test case for unrecognized command
     it 'test exit and unrecognized command and sql sentence' do
         result = run_script([
@@ -54,17 +59,22 @@ describe "database" do
         ])
     end
 
-    # test case for corner cases / when table is full
-    it 'prints error message when table is full' do
+    # test case for many rows with a cache smaller than the table
+    it 'keeps all rows when the table outgrows the cache' do
         script = (1..1400).map do |i|
             "insert #{i} user#{i} person#{i}@example.com"
         end
         script << ".exit"
-        result = run_script(script)
+        result = run_script(script, "--cache-pages 16")
         expect(result.last(2)).to match_array([
             "db > Executed.",
-            "db > Need to implement updating parent after split",
+            "db > Bye!",
         ])
+
+        result = run_script(["select", ".exit"], "--cache-pages 16")
+        expect(result.length).to eq(1402)
+        expect(result.first).to eq("db > (1, user1, person1@example.com)")
+        expect(result[-3]).to eq("(1400, user1400, person1400@example.com)")
     end
 
     # test case for corner cases / when entered string is at maximum
@@ -169,12 +179,12 @@ describe "database" do
 
         expect(result).to match_array([
                             "db > Constants:",
-                            "ROW_SIZE: 293",
+                            "ROW_MAX_SIZE: 293",
                             "COMMON_NODE_HEADER_SIZE: \u0006",
-                            "LEAF_NODE_HEADER_SIZE: 14",
-                            "LEAF_NODE_CELL_SIZE: 297",
-                            "LEAF_NODE_SPACE_FOR_CELLS: 4082",
-                            "LEAF_NODE_MAX_CELLS: 13",
+                            "LEAF_NODE_HEADER_SIZE: 18",
+                            "LEAF_NODE_SLOT_SIZE: 8",
+                            "LEAF_NODE_SPACE_FOR_CELLS: 4078",
+                            "INTERNAL_NODE_MAX_KEYS: 338",
                             "db > Bye!",
         ])
     end
@@ -198,16 +208,16 @@ describe "database" do
     end
 
     it "allows printing out the structure of a 3-leaf-node btree" do
-        script = (1..14).map do |i|
-            "insert #{i} user#{i} person#{i}@example.com"
+        script = (1..15).map do |i|
+            "insert #{i} user#{i} #{long_email(i)}"
         end
         script << ".btree"
-        script << "insert 15 user15 person15@example.com"
+        script << "insert 16 user16 #{long_email(16)}"
         script << ".btree"
         script << ".exit"
         result = run_script(script)
 
-        expect(result[14...(result.length)]).to match_array([
+        expect(result[15...(result.length)]).to match_array([
             "db > Tree:",
             "- internal (size 1)",
             "  - leaf (size 7)",
@@ -219,7 +229,7 @@ describe "database" do
             "    - 6",
             "    - 7",
             "  - key 7",
-            "  - leaf (size 7)",
+            "  - leaf (size 8)",
             "    - 8",
             "    - 9",
             "    - 10",
@@ -227,6 +237,7 @@ describe "database" do
             "    - 12",
             "    - 13",
             "    - 14",
+            "    - 15",
             "db > Executed.",
             "db > Tree:",
             "- internal (size 1)",
@@ -239,7 +250,7 @@ describe "database" do
             "    - 6",
             "    - 7",
             "  - key 7",
-            "  - leaf (size 8)",
+            "  - leaf (size 9)",
             "    - 8",
             "    - 9",
             "    - 10",
@@ -248,6 +259,7 @@ describe "database" do
             "    - 13",
             "    - 14",
             "    - 15",
+            "    - 16",
             "db > Bye!",
         ])
     end
@@ -255,30 +267,798 @@ describe "database" do
     it "prints all rows in a multi-level tree" do
         script = []
         (1..15).each do |i|
-            script << "insert #{i} user#{i} person#{i}@example.com"
+            script << "insert #{i} user#{i} #{long_email(i)}"
         end
         script << "select"
         script << ".exit"
         result = run_script(script)
-        expect(result[15...result.length]).to match_array([        
+        expect(result[15...result.length]).to match_array([
+            "db > (1, user1, #{long_email(1)})",
+            *(2..15).map { |i| "(#{i}, user#{i}, #{long_email(i)})" },
+            "Executed.",
+            "db > Bye!",
+        ])
+    end
+
+    it "does not rewrite the file after a read-only session" do
+        run_script([
+            "insert 1 user1 person1@example.com",
+            ".exit",
+        ])
+        mtime = File.mtime("test.db")
+        sleep 0.01
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "db > (1, user1, person1@example.com)",
+            "Executed.",
+            "db > Bye!",
+        ])
+        expect(File.mtime("test.db")).to eq(mtime)
+    end
+
+    it "flushes dirty pages on checkpoint" do
+        result = run_script([
+            "insert 1 user1 person1@example.com",
+            ".checkpoint",
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "db > Executed.",
+            "db > db > (1, user1, person1@example.com)",
+            "Executed.",
+            "db > Bye!",
+        ])
+    end
+
+    it "reads and writes through the mmap backend" do
+        script = (1..15).map do |i|
+            "insert #{i} user#{i} #{long_email(i)}"
+        end
+        script << ".exit"
+        run_script(script, "--mmap")
+        expect(File.size("test.db")).to eq(4 * 4096)
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result.length).to eq(17)
+        expect(result.first).to eq("db > (1, user1, #{long_email(1)})")
+
+        result = run_script([
+            "insert 16 user16 person16@example.com",
+            "select",
+            ".exit",
+        ], "--mmap")
+        expect(result[-3]).to eq("(16, user16, person16@example.com)")
+    end
+
+    it "stores pages compressed when created with --compress" do
+        script = (1..1000).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+        uncompressed_size = File.size("test.db")
+        File.delete("test.db")
+        run_script(script, "--compress")
+        expect(File.size("test.db") * 3 < uncompressed_size * 2).to eq(true)
+
+        result = run_script([
+            "insert 1001 user1001 person1001@example.com",
+            "select where id between 999 and 1001",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "db > Executed.",
+            "db > (999, user999, person999@example.com)",
+            "(1000, user1000, person1000@example.com)",
+            "(1001, user1001, person1001@example.com)",
+            "Executed.",
+            "db > Bye!",
+        ])
+        expect(run_script([".exit"], "--mmap")).to match_array([
+            "Error: compressed databases cannot use the mmap backend.",
+        ])
+    end
+
+    it "finds the same rows with every key search" do
+        script = (1..3000).to_a.shuffle.map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+
+        lookups = [
+            "select where id = 1",
+            "select where id = 1777",
+            "select where id = 3001",
+            "select where id between 1500 and 1503",
+            ".exit",
+        ]
+        expected = run_script(lookups, "--key-search scalar")
+        expect(expected[0]).to eq("db > (1, user1, person1@example.com)")
+        ["sse2", "avx2", "auto"].each do |search|
+            result = run_script(lookups, "--key-search #{search}")
+            next if result == ["Unsupported key search: #{search}"]
+            expect(result).to eq(expected)
+        end
+    end
+
+    it "recovers committed rows from the log after a crash" do
+        IO.popen("./db test.db", "r+") do |pipe|
+            (1..3).each do |i|
+                pipe.puts "insert #{i} user#{i} person#{i}@example.com"
+            end
+            output = ""
+            output << pipe.readpartial(1024) until output.scan("Executed.").length == 3
+            Process.kill("KILL", pipe.pid)
+        end
+        expect(File.size("test.db-wal")).to eq(16 + 5 * (16 + 4096))
+        # Pages past the last commit, as a bulk load cut short leaves them
+        File.open("test.db", "ab") { |file| file.write("x" * 2 * 4096) }
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
             "db > (1, user1, person1@example.com)",
             "(2, user2, person2@example.com)",
             "(3, user3, person3@example.com)",
-            "(4, user4, person4@example.com)",
-            "(5, user5, person5@example.com)",
-            "(6, user6, person6@example.com)",
-            "(7, user7, person7@example.com)",
-            "(8, user8, person8@example.com)",
-            "(9, user9, person9@example.com)",
-            "(10, user10, person10@example.com)",
-            "(11, user11, person11@example.com)",
+            "Executed.",
+            "db > Bye!",
+        ])
+        expect(File.exist?("test.db-wal")).to eq(false)
+        expect(File.size("test.db")).to eq(2 * 4096)
+    end
+
+    it "recovers the log after a crash when reopened with mmap" do
+        IO.popen("./db test.db", "r+") do |pipe|
+            pipe.puts "insert 1 a a@x"
+            output = ""
+            output << pipe.readpartial(1024) until output.include?("Executed.")
+            Process.kill("KILL", pipe.pid)
+        end
+        expect(File.size("test.db-wal") > 0).to eq(true)
+
+        result = run_script(["select", "insert 2 b b@x", ".exit"], "--batch --mmap")
+        expect(result).to eq(["(1, a, a@x)"])
+        expect(File.exist?("test.db-wal")).to eq(false)
+
+        result = run_script(["select", ".exit"], "--batch")
+        expect(result).to eq(["(1, a, a@x)", "(2, b, b@x)"])
+    end
+
+    it "splits internal nodes once the tree grows past two levels" do
+        script = (1..4000).map do |i|
+            "insert #{i} user#{i} #{long_email(i)}"
+        end
+        script << ".btree"
+        script << ".exit"
+        result = run_script(script)
+        tree = result[4000..-1].reject { |line| line.start_with?("      -") }
+        expect(tree.select { |line| line.include?("internal") || line.start_with?("  - key") }).to eq([
+            "- internal (size 2)",
+            "  - internal (size 169)",
+            "  - key 1190",
+            "  - internal (size 169)",
+            "  - key 2380",
+            "  - internal (size 230)",
+        ])
+    end
+
+    it "keeps keys in order with random inserts" do
+        ids = (1..3000).to_a.shuffle(random: Random.new(1))
+        script = ids.map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "select"
+        script << ".exit"
+        result = run_script(script)
+        rows = result[3000...-2].map { |line| line.sub("db > ", "") }
+        expect(rows).to eq((1..3000).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" })
+    end
+
+    it "bulk loads unsorted csv rows into filled leaves" do
+        File.write("test.csv", (1..20).to_a.reverse.map { |i| "#{i},user#{i},#{long_email(i)}\n" }.join)
+        result = run_script([
+            ".import test.csv 50",
+            ".btree",
+            ".import test.csv",
+            ".exit",
+        ])
+        File.delete("test.csv")
+        expect(result).to eq([
+            "db > Imported 20 rows.",
+            "db > Tree:",
+            "- internal (size 2)",
+            "  - leaf (size 7)",
+            *(1..7).map { |i| "    - #{i}" },
+            "  - key 7",
+            "  - leaf (size 7)",
+            *(8..14).map { |i| "    - #{i}" },
+            "  - key 14",
+            "  - leaf (size 6)",
+            *(15..20).map { |i| "    - #{i}" },
+            "db > Error: .import requires an empty table.",
+            "db > Bye!",
+        ])
+    end
+
+    it "bulk loads a binary row file" do
+        records = (1..100).map do |i|
+            [i].pack("L<") + "user#{i}".ljust(33, "\0") + "person#{i}@example.com".ljust(256, "\0")
+        end
+        File.binwrite("test.rows", records.join)
+        result = run_script([
+            ".import test.rows",
+            "insert 101 user101 person101@example.com",
+            "select",
+            ".exit",
+        ])
+        File.delete("test.rows")
+        expect(result[0]).to eq("db > Imported 100 rows.")
+        expect(result[2]).to eq("db > (1, user1, person1@example.com)")
+        expect(result[-3]).to eq("(101, user101, person101@example.com)")
+        expect(result.length).to eq(105)
+    end
+
+    it "selects a key range with a limit" do
+        script = (1..30).map do |i|
+            "insert #{i * 2} user#{i * 2} person#{i * 2}@example.com"
+        end
+        script << "select where id between 13 and 19"
+        script << "select where id between 57 and 100"
+        script << "select where id between 61 and 100"
+        script << "select where id between 10 and 40 limit 2"
+        script << "select limit 1"
+        script << "select where id between 1"
+        script << ".exit"
+        result = run_script(script)
+        expect(result[30..-1]).to eq([
+            "db > (14, user14, person14@example.com)",
+            "(16, user16, person16@example.com)",
+            "(18, user18, person18@example.com)",
+            "Executed.",
+            "db > (58, user58, person58@example.com)",
+            "(60, user60, person60@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > (10, user10, person10@example.com)",
             "(12, user12, person12@example.com)",
-            "(13, user13, person13@example.com)",
-            "(14, user14, person14@example.com)",
-            "(15, user15, person15@example.com)",
             "Executed.",
+            "db > (2, user2, person2@example.com)",
+            "Executed.",
+            "db > Syntax error. Could not parse statement.",
             "db > Bye!",
         ])
     end
 
-end
\ No newline at end of file
+    it "looks up a single row by id" do
+        script = (1..30).map do |i|
+            "insert #{i * 2} user#{i * 2} person#{i * 2}@example.com"
+        end
+        script << "select where id = 42"
+        script << "select where id = 43"
+        script << "select where id = 100"
+        script << "select where id = -1"
+        script << ".exit"
+        result = run_script(script)
+        expect(result[30..-1]).to eq([
+            "db > (42, user42, person42@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > ID must be positive.",
+            "db > Bye!",
+        ])
+    end
+
+    it "inserts a batch of rows with insert values" do
+        values = (1..2000).to_a.shuffle.map { |i| "(#{i}, user#{i}, person#{i}@example.com)" }
+        result = run_script([
+            "insert values #{values.join(", ")}",
+            "insert values (2001, a, a@example.com), (5, b, b@example.com)",
+            "insert values (2002, a, a@example.com) (2003, b, b@example.com)",
+            "select where id between 1999 and 2002",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > Executed.",
+            "db > Error: Duplicate key.",
+            "db > Syntax error. Could not parse statement.",
+            "db > (1999, user1999, person1999@example.com)",
+            "(2000, user2000, person2000@example.com)",
+            "Executed.",
+            "db > Bye!",
+        ])
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result.length).to eq(2002)
+    end
+
+    it "commits a batch larger than the cache all at once" do
+        values = (1..3000).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" }
+        IO.popen("./db test.db --cache-pages 16", "r+") do |pipe|
+            pipe.puts "insert values #{values.join(", ")}"
+            output = ""
+            output << pipe.readpartial(1024) until output.include?("Executed.")
+            Process.kill("KILL", pipe.pid)
+        end
+        # The batch outgrew the pool, so pages were spilled to the log
+        wal_size = File.size("test.db-wal")
+        expect(wal_size > 16 + 16 * (16 + 4096)).to eq(true)
+        File.write("crash.db", File.binread("test.db"))
+        File.write("crash.db-wal", File.binread("test.db-wal"))
+
+        result = run_script(["select count(*)", "select where username = user2999", ".exit"], "--batch --cache-pages 16")
+        expect(result).to eq(["3000", "(2999, user2999, person2999@example.com)"])
+
+        # Without the commit mark at its end none of the batch is replayed
+        File.rename("crash.db", "test.db")
+        File.rename("crash.db-wal", "test.db-wal")
+        File.truncate("test.db-wal", wal_size - (16 + 4096))
+        result = run_script(["select count(*)", ".exit"], "--batch")
+        expect(result).to eq(["0"])
+    end
+
+    it "prints only results and errors in batch mode" do
+        result = run_script([
+            "insert 2 user2 person2@example.com",
+            "insert 1 user1 person1@example.com",
+            "insert 1 user1 person1@example.com",
+            "select",
+        ], "--batch")
+        expect(result).to eq([
+            "Error: Duplicate key.",
+            "(1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+        ])
+
+        result = run_script([
+            "select where id = 2",
+        ])
+        expect(result).to eq([
+            "db > (2, user2, person2@example.com)",
+            "Executed.",
+            "db > Bye!",
+        ])
+    end
+
+    it "finds rows by username and email through secondary indexes" do
+        script = (1..300).map do |i|
+            "insert #{i} user#{i % 20} #{long_email(i)}"
+        end
+        script.insert(150, "create index on email")
+        result = run_script(script + [
+            "create index on username",
+            "create index on username",
+            "create index on id",
+            "select where username = user7",
+            "select where email like person12%",
+            "select where email like person12",
+            ".exit",
+        ], "--batch")
+        expect(result).to eq([
+            "Error: Index already exists.",
+            "Syntax error. Could not parse statement.",
+        ] + [7, 27, 47, 67, 87, 107, 127, 147, 167, 187, 207, 227, 247, 267, 287].map do |i|
+            "(#{i}, user#{i % 20}, #{long_email(i)})"
+        end + [120, 121, 122, 123, 124, 125, 126, 127, 128, 129, 12].map do |i|
+            "(#{i}, user#{i % 20}, #{long_email(i)})"
+        end + [
+            "Syntax error. Could not parse statement.",
+        ])
+
+        result = run_script([
+            "insert 301 user7 a@example.com",
+            "select where username = user7 ",
+            "select where email = a@example.com",
+            "select where username like zzz%",
+            ".exit",
+        ], "--batch")
+        expect(result.length).to eq(17)
+        expect(result.last).to eq("(301, user7, a@example.com)")
+        expect(result[-2]).to eq("(301, user7, a@example.com)")
+    end
+
+    it "deletes and updates rows, merging leaves and collapsing the root" do
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} #{long_email(i)}"
+        end
+        result = run_script(script + [
+            "delete where id between 3 and 28",
+            "delete where id = 2",
+            "delete where id = 2",
+            "update 1 alice short@example.com",
+            "update 30 bob #{long_email(30)}",
+            "update 31 carol carol@example.com",
+            ".btree",
+            "select",
+            ".exit",
+        ], "--batch")
+        expect(result).to eq([
+            "Error: No row with that id.",
+            "Tree:",
+            "- leaf (size 3)",
+            "  - 1",
+            "  - 29",
+            "  - 30",
+            "(1, alice, short@example.com)",
+            "(29, user29, #{long_email(29)})",
+            "(30, bob, #{long_email(30)})",
+        ])
+    end
+
+    it "merges emptied index nodes and reuses their pages" do
+        script = (1..150).map do |i|
+            "insert #{i} user#{i} #{long_email(i)}"
+        end
+        run_script(["create index on email"] + script + [".exit"])
+        full_size = File.size("test.db")
+
+        # New emails sort after the old ones, so leftover index leaves
+        # would not be reused
+        script = (1..150).map do |i|
+            "insert #{i} user#{i} #{long_email(i).sub("person", "pupil")}"
+        end
+        result = run_script([
+            "delete where id between 1 and 150",
+        ] + script + [
+            "delete where id between 1 and 140",
+            "select where email = #{long_email(145).sub("person", "pupil")}",
+            "select where email like person%",
+            "select count(*) where email like pupil%",
+            ".exit",
+        ], "--batch")
+        expect(result).to eq([
+            "(145, user145, #{long_email(145).sub("person", "pupil")})",
+            "10",
+        ])
+        expect(File.size("test.db")).to eq(full_size)
+    end
+
+    it "deletes a range larger than the cache in one commit" do
+        File.write("test.csv", (1..3000).map { |i| "#{i},user#{i},person#{i}@example.com\n" }.join)
+        run_script([".import test.csv", ".exit"])
+        File.delete("test.csv")
+
+        IO.popen("./db test.db --cache-pages 16", "r+") do |pipe|
+            pipe.puts "delete where id between 1 and 2990"
+            output = ""
+            output << pipe.readpartial(1024) until output.include?("Executed.")
+            Process.kill("KILL", pipe.pid)
+        end
+        wal_size = File.size("test.db-wal")
+        expect(wal_size > 16 + 16 * (16 + 4096)).to eq(true)
+
+        # Cut off the commit mark: the whole delete is undone
+        File.truncate("test.db-wal", wal_size - (16 + 4096))
+        result = run_script(["select count(*)", ".exit"], "--batch")
+        expect(result).to eq(["3000"])
+    end
+
+    it "counts rows and finds the smallest and largest id" do
+        File.write("test.csv", (1..5000).map { |i| "#{i},user#{i % 10},person#{i}@example.com\n" }.join)
+        result = run_script([
+            ".import test.csv",
+            "select count(*)",
+            "select min(id)",
+            "select max(id) where id between 100 and 4321",
+            "select count(*) where email like person12%",
+            "select count(*) where username = user3",
+            "select min(id) where id between 6000 and 7000",
+            "select count(*) limit 1",
+            ".exit",
+        ], "--batch")
+        File.delete("test.csv")
+        expect(result).to eq([
+            "Imported 5000 rows.",
+            "5000",
+            "1",
+            "4321",
+            "111",
+            "500",
+            "NULL",
+            "Syntax error. Could not parse statement.",
+        ])
+    end
+
+    it "counts id ranges and skips rows with offset" do
+        File.write("test.csv", (1..5000).map { |i| "#{i * 2},user#{i},person#{i}@example.com\n" }.join)
+        result = run_script([
+            ".import test.csv",
+            "insert 3 user3 person3@example.com",
+            "delete where id between 1001 and 2000",
+            "select count(*) where id between 1 and 3000",
+            "select where id between 1 and 10000 limit 2 offset 4000",
+            "select offset 4499",
+            "select limit 1 offset 5000",
+            "select count(*) offset 1",
+            "select max(id)",
+            "select min(id) where id between 1001 and 2500",
+            "select max(id) where id between 1 and 1999",
+            ".exit",
+        ], "--batch")
+        File.delete("test.csv")
+        expect(result).to eq([
+            "Imported 5000 rows.",
+            "1001",
+            "(9000, user4500, person4500@example.com)",
+            "(9002, user4501, person4501@example.com)",
+            "(9998, user4999, person4999@example.com)",
+            "(10000, user5000, person5000@example.com)",
+            "Syntax error. Could not parse statement.",
+            "10000",
+            "2002",
+            "1000",
+        ])
+    end
+
+    it "reuses freed pages and shrinks the file with vacuum" do
+        script = (1..150).map do |i|
+            "insert #{i} user#{i} #{long_email(i)}"
+        end
+        run_script(["create index on email"] + script + [".exit"])
+        full_size = File.size("test.db")
+
+        run_script(["delete where id between 1 and 140"] + script.first(140) + [".exit"])
+        expect(File.size("test.db")).to eq(full_size)
+
+        result = run_script([
+            "delete where id between 11 and 150",
+            ".vacuum",
+            "select",
+            "select where email = #{long_email(7)}",
+            ".exit",
+        ], "--batch")
+        expect(result).to eq((1..10).map do |i|
+            "(#{i}, user#{i}, #{long_email(i)})"
+        end + [
+            "(7, user7, #{long_email(7)})",
+        ])
+        # the root leaf, the schema page and the email index root
+        expect(File.size("test.db")).to eq(3 * 4096)
+    end
+
+    it "can be embedded as a library with prepared statements" do
+        File.write("api_test.cpp", <<~CPP)
+            #include <iostream>
+            #include "simpledb.h"
+
+            int main()
+            {
+                Database db("test.db");
+                db.put(2, "user2", "person2@example.com");
+                std::cout << db.put(2, "user2", "person2@example.com") << std::endl;
+
+                Statement insert;
+                prepare_statement("insert ? ? ?", insert);
+                for(uint32_t i = 3; i <= 5; i++)
+                {
+                    insert.bind(0, i);
+                    insert.bind(1, "user" + std::to_string(i));
+                    insert.bind(2, "person" + std::to_string(i) + "@example.com");
+                    db.execute(insert, nullptr);
+                }
+                std::cout << insert.bind(1, std::string(33, 'a')) << std::endl;
+
+                Row row;
+                std::cout << db.get(4, row) << " " << row.username << std::endl;
+                std::cout << db.get(6, row) << std::endl;
+
+                Statement select;
+                prepare_statement("select where id between ? and ? limit ?", select);
+                select.bind(0, 3);
+                select.bind(1, 5);
+                select.bind(2, 2);
+                db.execute(select, [](const RowView &r) { std::cout << r.id() << std::endl; return true; });
+                db.scan(0, 100, [](const RowView &r) { std::cout << r.email() << std::endl; return r.id() < 3; });
+
+                Statement count;
+                prepare_statement("select count(*)", count);
+                uint64_t value;
+                std::cout << (db.execute(count, nullptr) == EXECUTE_AGGREGATE) << std::endl;
+                std::cout << db.aggregate(count, value) << " " << value << std::endl;
+                return 0;
+            }
+        CPP
+        `make libsimpledb.a 2>&1 && g++ -std=c++17 -o api_test api_test.cpp libsimpledb.a 2>&1`
+        expect($?.success?).to eq(true)
+        result = `./api_test`.split("\n")
+        File.delete("api_test.cpp", "api_test")
+        expect(result).to eq([
+            "2",
+            "0",
+            "1 user4",
+            "0",
+            "3",
+            "4",
+            "person2@example.com",
+            "person3@example.com",
+            "1",
+            "1 4",
+        ])
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result.length).to eq(6)
+    end
+
+    it "benchmarks the library and reports latency percentiles" do
+        `make db_bench 2>&1`
+        expect($?.success?).to eq(true)
+        output = `./db_bench --db test.db --rows 2000 --ops 2000 --threads 2 --scans 2`.split("\n")
+        expect(output.first).to eq("benchmark,rows,ops,threads,seconds,ops_per_sec,p50_us,p99_us,p999_us,max_us")
+        results = output.drop(1).map { |line| line.split(",") }
+        expect(results.map(&:first)).to eq(["fillseq", "fillrandom", "readrandom", "readseq", "scanrange", "readwrite",
+                                            "readcold", "readcold"])
+        expect(results.last(2).map { |result| result[3] }).to eq(["1", "2"])
+        results.each do |result|
+            p50, p99, p999, max = result[6..9].map(&:to_f)
+            expect(p50 <= p99 && p99 <= p999 && p999 <= max).to eq(true)
+        end
+        expect(File.exist?("test.db")).to eq(false)
+    end
+
+    it "serves lookups and inserts from many threads at once" do
+        File.write("api_test.cpp", <<~CPP)
+            #include <atomic>
+            #include <iostream>
+            #include <thread>
+            #include "simpledb.h"
+
+            int main()
+            {
+                Database db("test.db", 32);
+                db.create_index(INDEX_USERNAME);
+                for(uint32_t i = 1; i <= 1000; i++)
+                {
+                    db.put(i, "user" + std::to_string(i), "person" + std::to_string(i) + "@example.com");
+                }
+
+                std::atomic<uint32_t> found(0);
+                std::vector<std::thread> threads;
+                for(uint32_t t = 0; t < 4; t++)
+                {
+                    threads.emplace_back([&db, t]() {
+                        for(uint32_t i = 1001 + t; i <= 3000; i += 4)
+                        {
+                            db.put(i, "user" + std::to_string(i), "person" + std::to_string(i) + "@example.com");
+                        }
+                    });
+                    threads.emplace_back([&db, &found]() {
+                        Row row;
+                        for(uint32_t i = 1; i <= 1000; i++)
+                        {
+                            found += db.get(i, row) && row.id == i;
+                        }
+                        db.find(INDEX_USERNAME, "user7", false, [&found](const RowView &) { found++; return true; });
+                    });
+                }
+                for(std::thread &thread : threads)
+                {
+                    thread.join();
+                }
+
+                uint32_t num_rows = 0;
+                uint32_t last_id = 0;
+                bool ordered = true;
+                db.scan(0, UINT32_MAX, [&](const RowView &r) {
+                    ordered = ordered && r.id() == last_id + 1;
+                    last_id = r.id();
+                    num_rows++;
+                    return true;
+                });
+                std::cout << found << " " << num_rows << " " << ordered << std::endl;
+                return 0;
+            }
+        CPP
+        `make libsimpledb.a 2>&1 && g++ -std=c++17 -pthread -o api_test api_test.cpp libsimpledb.a 2>&1`
+        expect($?.success?).to eq(true)
+        result = `./api_test`.split("\n")
+        File.delete("api_test.cpp", "api_test")
+        expect(result).to eq(["4004 3000 1"])
+
+        result = run_script([
+            "select where username = user2999",
+            ".exit",
+        ], "--batch")
+        expect(result).to eq(["(2999, user2999, person2999@example.com)"])
+    end
+
+    it "scans a multi-level tree in order while reading leaves ahead" do
+        File.write("test.csv", (1..20000).map { |i| "#{i},user#{i},#{long_email(i)}\n" }.join)
+        run_script([".import test.csv", ".exit"])
+        File.delete("test.csv")
+
+        ["--cache-pages 16", "--mmap"].each do |options|
+            result = run_script(["select", ".exit"], "--batch #{options}")
+            expect(result.length).to eq(20000)
+            expect(result.map { |line| line[/\d+/].to_i }).to eq((1..20000).to_a)
+        end
+    end
+
+    it "reports engine counters and the shape of the tree" do
+        script = (1..3000).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script, "--batch")
+        stats = result.grep(/^\w+: /).map { |line| line.split(": ") }.to_h
+
+        expect(stats["leaf_splits"]).to eq("62")
+        expect(stats["root_splits"]).to eq("1")
+        expect(stats["tree_height"]).to eq("2")
+        expect(stats["leaf_count"]).to eq("63")
+        expect(stats["row_count"]).to eq("3000")
+        expect(stats["leaf_fill_percent"]).to eq("50.5")
+        expect(stats["pages_logged"].to_i > 0).to eq(true)
+
+        result = run_script([".stats", ".exit"], "--batch")
+        stats = result.grep(/^\w+: /).map { |line| line.split(": ") }.to_h
+        expect(stats["leaf_splits"]).to eq("0")
+        expect(stats["pages_read"]).to eq("65")
+        expect(stats["row_count"]).to eq("3000")
+    end
+
+    it "times statements and logs slow ones with their rows examined" do
+        File.delete("test.log") if File.exist?("test.log")
+        script = (1..20).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script += [
+            ".timer on",
+            "select where id between 5 and 9",
+            ".timer off",
+            ".slowlog test.log 0",
+            "select where username = user7",
+            "select where id = 3",
+            ".slowlog off",
+            "select",
+            ".exit",
+        ]
+        result = run_script(script, "--batch")
+        timings = result.grep(/^Run Time: /)
+        expect(timings.size).to eq(1)
+        expect(timings[0].match?(/^Run Time: [\d.]+ ms \(parse [\d.]+ ms, execute [\d.]+ ms, of which I\/O [\d.]+ ms\)$/)).to eq(true)
+
+        log = File.readlines("test.log", chomp: true)
+        File.delete("test.log")
+        expect(log.size).to eq(2)
+        expect(log[0].match?(/^[\d.]+ ms, I\/O [\d.]+ ms, \d+ page misses, 20 rows examined: select where username = user7$/)).to eq(true)
+        expect(log[1].end_with?(" 1 rows examined: select where id = 3")).to eq(true)
+    end
+
+    it "refuses a cache size that is not a page count" do
+        ["-1", "abc", "16x", "99999999999"].each do |pages|
+            result = run_script([".exit"], "--cache-pages #{pages}")
+            expect(result).to eq(["Unsupported cache size: #{pages}"])
+        end
+    end
+
+    it "refuses files of an older or unknown format" do
+        # A leaf root of the unslotted layout, which has no schema page
+        File.binwrite("test.db", [1, 1, 0, 1, 0, 7].pack("CCVVVV").ljust(4096, "\0"))
+        expect(run_script([".exit"])).to eq(["Unsupported database format. Import the data again."])
+
+        File.delete("test.db")
+        run_script(["insert 1 user1 person1@example.com", ".exit"])
+        File.open("test.db", "r+b") do |file|
+            file.seek(4096 + 22)
+            file.write([99].pack("V"))
+        end
+        expect(run_script([".exit"])).to eq(["Unsupported database format version 99, expected 1. Import the data again."])
+    end
+end
@@ -0,0 +1,40 @@
+# Compares the node key searches on point lookups: bulk load ROWS rows
+# once, then run LOOKUPS random select where id = N with each search.
+#
+#   ruby lookup_bench.rb [ROWS] [LOOKUPS]
+
+ROWS = (ARGV[0] || 100000).to_i
+LOOKUPS = (ARGV[1] || 100000).to_i
+DB_FILE = "bench.db"
+CSV_FILE = "bench.csv"
+SCRIPT_FILE = "bench.script"
+
+def run(commands, options)
+    # Feed the script from a file, a pipe would fill up with output
+    File.write(SCRIPT_FILE, commands.join("\n") + "\n")
+    output = IO.popen("./db #{DB_FILE} #{options} < #{SCRIPT_FILE}", &:read)
+    File.delete(SCRIPT_FILE)
+    output
+end
+
+def time
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    yield
+    Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+end
+
+File.delete(DB_FILE) if File.exist?(DB_FILE)
+File.write(CSV_FILE, (1..ROWS).map { |i| "#{i},user#{i},person#{i}@example.com\n" }.join)
+run([".import #{CSV_FILE}", ".exit"], "")
+File.delete(CSV_FILE)
+
+srand(42)
+lookup_script = Array.new(LOOKUPS) { "select where id = #{rand(1..ROWS)}" } << ".exit"
+
+puts "key_search,rows,lookups,seconds,us_per_lookup"
+["scalar", "sse2", "avx2"].each do |search|
+    next unless run([".exit"], "--key-search #{search}").include?("Bye!")
+    seconds = time { run(lookup_script, "--key-search #{search}") }
+    puts format("%s,%d,%d,%.4f,%.3f", search, ROWS, LOOKUPS, seconds, seconds * 1e6 / LOOKUPS)
+end
+File.delete(DB_FILE) if File.exist?(DB_FILE)
@@ -0,0 +1,38 @@
+# Compares the buffer pool and mmap pager backends, and the buffer pool
+# over a compressed file, on a read-heavy workload: load ROWS rows once,
+# then run SCANS full-table selects.
+#
+#   ruby pager_bench.rb [ROWS] [SCANS]
+
+ROWS = (ARGV[0] || 1000).to_i
+SCANS = (ARGV[1] || 200).to_i
+DB_FILE = "bench.db"
+
+def run(commands, options)
+    output = nil
+    IO.popen("./db #{DB_FILE} #{options}", "r+") do |pipe|
+        pipe.write(commands.join("\n") + "\n")
+        pipe.close_write
+        output = pipe.read
+    end
+    output
+end
+
+def time
+    start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    yield
+    Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+end
+
+load_script = (1..ROWS).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+load_script << ".exit"
+scan_script = Array.new(SCANS, "select") << ".exit"
+
+puts "backend,rows,scans,load_seconds,scan_seconds,file_bytes"
+[["buffer_pool", ""], ["mmap", "--mmap"], ["compressed", "--compress"]].each do |name, options|
+    File.delete(DB_FILE) if File.exist?(DB_FILE)
+    load_seconds = time { run(load_script, options) }
+    scan_seconds = time { run(scan_script, options) }
+    puts format("%s,%d,%d,%.4f,%.4f,%d", name, ROWS, SCANS, load_seconds, scan_seconds, File.size(DB_FILE))
+end
+File.delete(DB_FILE) if File.exist?(DB_FILE)
@@ -0,0 +1,6558 @@
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <chrono>
+
+#include<fcntl.h>
+#include<unistd.h>
+#include<limits.h>
+#include<sys/uio.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include<linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+
+#include "simpledb.h"
+
+using namespace std;
+
+enum NodeType
+{
+    NODE_INTERNAL,
+    NODE_LEAF,
+    NODE_INDEX_INTERNAL,
+    NODE_INDEX_LEAF,
+    NODE_SCHEMA,
+    NODE_FREE
+};
+
+#define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
+
+// Fixed-width row record, the format of binary .import files
+const uint32_t ID_SIZE = size_of_attribute(Row, id);
+const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
+const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
+const uint32_t ID_OFFSET = 0;
+const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
+const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
+const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+
+// Serialized Row Layout: the id, then each string as a one byte
+// length followed by that many bytes. RowView reads it in place
+const uint32_t ROW_LENGTH_PREFIX_SIZE = sizeof(uint8_t);
+const uint32_t ROW_MAX_SIZE = ID_SIZE + 2 * ROW_LENGTH_PREFIX_SIZE
+                              + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE;
+
+uint32_t serialize_row(Row &source, void *destination)
+{
+    // Returns the number of bytes written, at most ROW_MAX_SIZE
+    char *cursor = (char *)destination;
+    memcpy(cursor, &(source.id), ID_SIZE);
+    cursor += ID_SIZE;
+
+    uint8_t username_length = strnlen(source.username, COLUMN_USERNAME_SIZE);
+    *(uint8_t *)cursor = username_length;
+    memcpy(cursor + ROW_LENGTH_PREFIX_SIZE, source.username, username_length);
+    cursor += ROW_LENGTH_PREFIX_SIZE + username_length;
+
+    uint8_t email_length = strnlen(source.email, COLUMN_EMAIL_SIZE);
+    *(uint8_t *)cursor = email_length;
+    memcpy(cursor + ROW_LENGTH_PREFIX_SIZE, source.email, email_length);
+    cursor += ROW_LENGTH_PREFIX_SIZE + email_length;
+
+    return cursor - (char *)destination;
+}
+
+const uint32_t PAGE_SIZE = 4096;
+
+/*
+Key search. Nodes keep their keys sorted in one contiguous array. The
+vector searches binary search down to a window of a few cache lines,
+then count the keys below the target with vector compares, which needs
+no branches on key values. The implementation is picked at startup from
+what the CPU supports.
+*/
+#define KEY_SEARCH_WINDOW 32   // keys left when the binary search stops
+
+uint32_t key_lower_bound_scalar(const uint32_t *keys, uint32_t count, uint32_t key)
+{
+    // Index of the first key >= key, count if there is none
+    uint32_t low = 0;
+    uint32_t high = count;
+    while(low != high)
+    {
+        uint32_t middle = (low + high) / 2;
+        if(keys[middle] < key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void key_search_narrow(const uint32_t *keys, uint32_t key, uint32_t &low, uint32_t &high)
+{
+    while(high - low > KEY_SEARCH_WINDOW)
+    {
+        uint32_t middle = (low + high) / 2;
+        if(keys[middle] < key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+uint32_t key_lower_bound_sse2(const uint32_t *keys, uint32_t count, uint32_t key)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+    key_search_narrow(keys, key, low, high);
+
+    // Keys are unsigned; flip the sign bits so a signed compare orders them
+    const __m128i bias = _mm_set1_epi32(0x80000000);
+    const __m128i target = _mm_xor_si128(_mm_set1_epi32(key), bias);
+    uint32_t below = low;
+    uint32_t i = low;
+    for(; i + 4 <= high; i += 4)
+    {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(keys + i)), bias);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(target, block)));
+        below += __builtin_popcount(mask);
+    }
+    for(; i < high; i++)
+    {
+        below += keys[i] < key;
+    }
+    return below;
+}
+
+__attribute__((target("avx2,popcnt")))
+uint32_t key_lower_bound_avx2(const uint32_t *keys, uint32_t count, uint32_t key)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+    key_search_narrow(keys, key, low, high);
+
+    const __m256i bias = _mm256_set1_epi32(0x80000000);
+    const __m256i target = _mm256_xor_si256(_mm256_set1_epi32(key), bias);
+    uint32_t below = low;
+    uint32_t i = low;
+    for(; i + 8 <= high; i += 8)
+    {
+        __m256i block = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(keys + i)), bias);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(target, block)));
+        below += __builtin_popcount(mask);
+    }
+    for(; i < high; i++)
+    {
+        below += keys[i] < key;
+    }
+    return below;
+}
+#endif
+
+uint32_t (*key_lower_bound)(const uint32_t *keys, uint32_t count, uint32_t key) = key_lower_bound_scalar;
+
+bool select_key_search(const string &name)
+{
+    /*
+    Pick the key search: "auto" takes the widest one the CPU supports.
+    Returns false if the named search is unknown or unsupported here.
+    */
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if(name == "avx2" || (name == "auto" && has_avx2))
+    {
+        key_lower_bound = key_lower_bound_avx2;
+        return has_avx2;
+    }
+    if(name == "sse2" || name == "auto")
+    {
+        key_lower_bound = key_lower_bound_sse2;
+        return true;
+    }
+#else
+    if(name == "auto")
+    {
+        key_lower_bound = key_lower_bound_scalar;
+        return true;
+    }
+#endif
+    if(name == "scalar")
+    {
+        key_lower_bound = key_lower_bound_scalar;
+        return true;
+    }
+    return false;
+}
+
+// Common Node Header Layout
+const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
+const uint32_t NODE_TYPE_OFFSET = 0;
+const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
+const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
+const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
+const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+
+class Node
+{
+protected:
+    void *node;
+public:
+    Node(){}
+    Node(void *node) : node(node){}
+    virtual ~Node(){}
+
+    NodeType get_node_type()
+    {
+        uint8_t value = *((uint8_t *)((char *)node + NODE_TYPE_OFFSET));
+        return (NodeType)value;
+    }
+
+    void set_node_type(NodeType type)
+    {
+        *((uint8_t *)((char *)node + NODE_TYPE_OFFSET)) = (uint8_t)type;
+    }
+
+    void *get_node()
+    {
+        return node;
+    }
+
+    bool is_node_root()
+    {
+        uint8_t value = *((uint8_t *)((char *)node + IS_ROOT_OFFSET));
+        return value == 1;
+    }
+
+    void set_node_root(bool is_root)
+    {
+        *((uint8_t *)((char *)node + IS_ROOT_OFFSET)) = is_root ? 1 : 0;
+    }
+
+    uint32_t *node_parent()
+    {
+        return (uint32_t *)((char *)node + PARENT_POINTER_OFFSET);
+    }
+};
+
+// Leaf Node Header Layout
+const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_CONTENT_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE 
+                                    + LEAF_NODE_NUM_CELLS_SIZE
+                                    + LEAF_NODE_NEXT_LEAF_SIZE
+                                    + LEAF_NODE_CONTENT_START_SIZE;
+
+/*
+Leaf Node Body Layout (slotted page)
+After the header come the keys of all cells in one array, then an
+array of value slots (payload offset and size) in the same order, so
+searches only touch the keys. Row payloads grow down from the end of
+the page; the content start in the header is the offset of the lowest
+payload.
+*/
+const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_VALUE_OFFSET_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_VALUE_OFFSET_OFFSET = 0;
+const uint32_t LEAF_NODE_VALUE_SIZE_SIZE = sizeof(uint16_t);
+const uint32_t LEAF_NODE_VALUE_SIZE_OFFSET = LEAF_NODE_VALUE_OFFSET_OFFSET + LEAF_NODE_VALUE_OFFSET_SIZE;
+const uint32_t LEAF_NODE_VALUE_SLOT_SIZE = LEAF_NODE_VALUE_OFFSET_SIZE + LEAF_NODE_VALUE_SIZE_SIZE;
+const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SLOT_SIZE;   // per cell
+const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
+
+class LeafNode : public Node
+{
+public:
+    LeafNode(){};
+    LeafNode(void *node) : Node(node){}
+
+    void initialize_leaf_node()
+    {
+        set_node_type(NODE_LEAF);
+        set_node_root(false);
+        *leaf_node_num_cells() = 0;
+        *leaf_node_next_leaf() = 0; // 0 = no sibling
+        *leaf_node_content_start() = PAGE_SIZE;
+    }
+
+    uint32_t *leaf_node_num_cells()
+    {
+        return (uint32_t *)((char *)node + LEAF_NODE_NUM_CELLS_OFFSET);
+    }
+
+    uint32_t *leaf_node_content_start()
+    {
+        return (uint32_t *)((char *)node + LEAF_NODE_CONTENT_START_OFFSET);
+    }
+
+    uint32_t *leaf_node_keys()
+    {
+        return (uint32_t *)((char *)node + LEAF_NODE_HEADER_SIZE);
+    }
+
+    uint32_t *leaf_node_key(uint32_t cell_num)
+    {
+        return leaf_node_keys() + cell_num;
+    }
+
+    void *leaf_node_value_slot(uint32_t cell_num)
+    {
+        // The value slots start right after the last key
+        return (char *)node + LEAF_NODE_HEADER_SIZE + *leaf_node_num_cells() * LEAF_NODE_KEY_SIZE
+               + cell_num * LEAF_NODE_VALUE_SLOT_SIZE;
+    }
+
+    uint16_t *leaf_node_value_offset(uint32_t cell_num)
+    {
+        return (uint16_t *)((char *)leaf_node_value_slot(cell_num) + LEAF_NODE_VALUE_OFFSET_OFFSET);
+    }
+
+    uint16_t *leaf_node_value_size(uint32_t cell_num)
+    {
+        return (uint16_t *)((char *)leaf_node_value_slot(cell_num) + LEAF_NODE_VALUE_SIZE_OFFSET);
+    }
+
+    uint32_t leaf_node_find_cell(uint32_t key)
+    {
+        // Index of the first cell with a key >= key
+        return key_lower_bound(leaf_node_keys(), *leaf_node_num_cells(), key);
+    }
+
+    void *leaf_node_value(uint32_t cell_num)
+    {
+        return (char *)node + *leaf_node_value_offset(cell_num);
+    }
+
+    uint32_t get_node_max_key()
+    {
+        return *leaf_node_key(*leaf_node_num_cells() - 1);
+    }
+
+    u_int32_t *leaf_node_next_leaf()
+    {
+        return (u_int32_t *)((char *)node + LEAF_NODE_NEXT_LEAF_OFFSET);
+    }
+
+    uint32_t leaf_node_free_space()
+    {
+        // Contiguous bytes between the slot array and the payloads
+        return *leaf_node_content_start() - LEAF_NODE_HEADER_SIZE
+               - *leaf_node_num_cells() * LEAF_NODE_SLOT_SIZE;
+    }
+
+    uint32_t leaf_node_used_space()
+    {
+        uint32_t used = 0;
+        for(uint32_t i = 0; i < *leaf_node_num_cells(); i++)
+        {
+            used += LEAF_NODE_SLOT_SIZE + *leaf_node_value_size(i);
+        }
+        return used;
+    }
+
+    void leaf_node_compact()
+    {
+        // Rewrite the payloads back to back at the end of the page,
+        // reclaiming the space of removed or shrunk rows
+        char buffer[PAGE_SIZE];
+        uint32_t content_start = PAGE_SIZE;
+        for(uint32_t i = 0; i < *leaf_node_num_cells(); i++)
+        {
+            uint32_t size = *leaf_node_value_size(i);
+            content_start -= size;
+            memcpy(buffer + content_start, leaf_node_value(i), size);
+            *leaf_node_value_offset(i) = content_start;
+        }
+        memcpy((char *)node + content_start, buffer + content_start, PAGE_SIZE - content_start);
+        *leaf_node_content_start() = content_start;
+    }
+
+    bool leaf_node_insert_cell(uint32_t cell_num, uint32_t key, const void *value, uint32_t size)
+    {
+        /*
+        Insert a cell at cell_num, shifting later keys and slots right.
+        Returns false, leaving the page untouched, if the cell does not
+        fit.
+        */
+        uint32_t needed = LEAF_NODE_SLOT_SIZE + size;
+        if(leaf_node_free_space() < needed)
+        {
+            if(LEAF_NODE_SPACE_FOR_CELLS - leaf_node_used_space() < needed)
+            {
+                return false;
+            }
+            leaf_node_compact();
+        }
+
+        /*
+        The value slots move one key further along, the ones from
+        cell_num on by one more slot to open a gap, then the keys from
+        cell_num on shift into the space that frees.
+        */
+        uint32_t num_cells = *leaf_node_num_cells();
+        char *slots = (char *)leaf_node_value_slot(0);
+        memmove(slots + LEAF_NODE_SLOT_SIZE + cell_num * LEAF_NODE_VALUE_SLOT_SIZE,
+                slots + cell_num * LEAF_NODE_VALUE_SLOT_SIZE,
+                (num_cells - cell_num) * LEAF_NODE_VALUE_SLOT_SIZE);
+        memmove(slots + LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_VALUE_SLOT_SIZE);
+        memmove(leaf_node_key(cell_num + 1), leaf_node_key(cell_num),
+                (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+        *leaf_node_num_cells() = num_cells + 1;
+
+        uint32_t content_start = *leaf_node_content_start() - size;
+        memcpy((char *)node + content_start, value, size);
+        *leaf_node_content_start() = content_start;
+
+        *leaf_node_key(cell_num) = key;
+        *leaf_node_value_offset(cell_num) = content_start;
+        *leaf_node_value_size(cell_num) = size;
+        return true;
+    }
+
+    void leaf_node_remove_cell(uint32_t cell_num)
+    {
+        /*
+        Remove the cell at cell_num, the reverse of an insert: later
+        keys shift left, then the value slots move one key back, the
+        later ones by one more slot. The payload is left as a hole
+        for leaf_node_compact(), unless it is the lowest one.
+        */
+        uint32_t num_cells = *leaf_node_num_cells();
+        uint32_t offset = *leaf_node_value_offset(cell_num);
+        uint32_t size = *leaf_node_value_size(cell_num);
+        char *slots = (char *)leaf_node_value_slot(0);
+        memmove(leaf_node_key(cell_num), leaf_node_key(cell_num + 1),
+                (num_cells - cell_num - 1) * LEAF_NODE_KEY_SIZE);
+        memmove(slots - LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_VALUE_SLOT_SIZE);
+        memmove(slots - LEAF_NODE_KEY_SIZE + cell_num * LEAF_NODE_VALUE_SLOT_SIZE,
+                slots + (cell_num + 1) * LEAF_NODE_VALUE_SLOT_SIZE,
+                (num_cells - cell_num - 1) * LEAF_NODE_VALUE_SLOT_SIZE);
+        *leaf_node_num_cells() = num_cells - 1;
+
+        if(offset == *leaf_node_content_start())
+        {
+            *leaf_node_content_start() = offset + size;
+        }
+    }
+
+};
+
+// Internal Node Header Layout
+const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + 
+                                                  INTERNAL_NODE_NUM_KEYS_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET = INTERNAL_NODE_RIGHT_CHILD_OFFSET +
+                                                  INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                           INTERNAL_NODE_NUM_KEYS_SIZE +
+                                           INTERNAL_NODE_RIGHT_CHILD_SIZE +
+                                           INTERNAL_NODE_RIGHT_COUNT_SIZE;
+
+/*
+Internal Node Body Layout
+A fixed-capacity key array, aligned for vector loads, followed by the
+array of the children left of each key and the array of the number of
+rows under each of those children. The right child's row count is in
+the header. The counts let a descent find the rank of a key or the row
+at a position.
+*/
+const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEYS_OFFSET = (INTERNAL_NODE_HEADER_SIZE + 15) / 16 * 16;
+const uint32_t INTERNAL_NODE_MAX_KEYS = (PAGE_SIZE - INTERNAL_NODE_KEYS_OFFSET) /
+                                        (INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_CHILD_SIZE +
+                                         INTERNAL_NODE_COUNT_SIZE);
+const uint32_t INTERNAL_NODE_CHILDREN_OFFSET = INTERNAL_NODE_KEYS_OFFSET +
+                                               INTERNAL_NODE_MAX_KEYS * INTERNAL_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_COUNTS_OFFSET = INTERNAL_NODE_CHILDREN_OFFSET +
+                                             INTERNAL_NODE_MAX_KEYS * INTERNAL_NODE_CHILD_SIZE;
+
+class InternalNode : public Node
+{
+public:
+    InternalNode(){};
+    InternalNode(void *node) : Node(node){}
+
+    void initialize_internal_node()
+    {
+        set_node_type(NODE_INTERNAL);
+        set_node_root(false);
+        *internal_node_num_keys() = 0;
+        *internal_node_right_count() = 0;
+    }
+
+    uint32_t *internal_node_num_keys()
+    {
+        return (uint32_t *)((char *)node + INTERNAL_NODE_NUM_KEYS_OFFSET);
+    }
+
+    uint32_t *internal_node_right_child()
+    {
+        return (uint32_t *)((char *)node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
+    }
+
+    uint32_t *internal_node_keys()
+    {
+        return (uint32_t *)((char *)node + INTERNAL_NODE_KEYS_OFFSET);
+    }
+
+    uint32_t *internal_node_children()
+    {
+        return (uint32_t *)((char *)node + INTERNAL_NODE_CHILDREN_OFFSET);
+    }
+
+    uint32_t *internal_node_right_count()
+    {
+        return (uint32_t *)((char *)node + INTERNAL_NODE_RIGHT_COUNT_OFFSET);
+    }
+
+    uint32_t *internal_node_counts()
+    {
+        return (uint32_t *)((char *)node + INTERNAL_NODE_COUNTS_OFFSET);
+    }
+
+    uint32_t *internal_node_count(uint32_t child_num)
+    {
+        // The number of rows under a child, numbered as in internal_node_child
+        return child_num == *internal_node_num_keys() ? internal_node_right_count()
+                                                      : internal_node_counts() + child_num;
+    }
+
+    uint64_t internal_node_total_count()
+    {
+        uint32_t num_keys = *internal_node_num_keys();
+        uint64_t total = *internal_node_right_count();
+        for(uint32_t i = 0; i < num_keys; i++)
+        {
+            total += internal_node_counts()[i];
+        }
+        return total;
+    }
+
+    uint32_t *internal_node_child(uint32_t child_num)
+    {
+        uint32_t num_keys = *internal_node_num_keys();
+        if(child_num > num_keys)
+        {
+            cout << "Tried to access child_num " << child_num << " > num_keys " << num_keys << endl;
+            exit(EXIT_FAILURE);
+        }
+        else if(child_num == num_keys)
+        {
+            return internal_node_right_child();
+        }
+        else
+        {
+            return internal_node_children() + child_num;
+        }
+    }
+
+    uint32_t *internal_node_key(uint32_t key_num)
+    {
+        return internal_node_keys() + key_num;
+    }
+
+    uint32_t internal_node_find_child(uint32_t key)
+    {
+        /*
+        Return the index of the child which should contain
+        the given key: the first whose key is >= key, or the right
+        child past the last key.
+        */
+        return key_lower_bound(internal_node_keys(), *internal_node_num_keys(), key);
+    }
+};
+
+/*
+Schema Page Layout
+The table root never has a parent, so its parent pointer holds the
+page number of the schema page, which is made with the file. The
+schema page holds the root page number of the index on each column, 0
+for none, the first page of the free list, then the format magic and
+version. Files without them, such as those written before leaves were
+slotted, are refused rather than misread. Index roots never move,
+except when .vacuum compacts the file.
+*/
+#define DB_FORMAT_MAGIC 0x53444246        // "SDBF"
+#define DB_FORMAT_VERSION 1               // slotted leaves, counted internal nodes
+
+const uint32_t SCHEMA_INDEX_ROOTS_OFFSET = COMMON_NODE_HEADER_SIZE;
+const uint32_t SCHEMA_FREE_PAGE_OFFSET = SCHEMA_INDEX_ROOTS_OFFSET + INDEX_COLUMN_COUNT * sizeof(uint32_t);
+const uint32_t SCHEMA_FORMAT_MAGIC_OFFSET = SCHEMA_FREE_PAGE_OFFSET + sizeof(uint32_t);
+const uint32_t SCHEMA_FORMAT_VERSION_OFFSET = SCHEMA_FORMAT_MAGIC_OFFSET + sizeof(uint32_t);
+
+/*
+Free Page Layout
+Pages dropped from a tree are chained into the free list, newest first,
+and handed out again before the file grows. A free page holds only the
+number of the next one, 0 at the end of the list.
+*/
+const uint32_t FREE_PAGE_NEXT_OFFSET = COMMON_NODE_HEADER_SIZE;
+
+/*
+Index Layout
+A secondary index is a B+ tree of (column value, id) entries kept in
+LeafNode's slotted page format. An entry is the value's length in one
+byte, the value, then the id; entries order by value bytes, a prefix
+before longer values, then by id, so equal values sit together in id
+order. The key of each cell is the first four value bytes big-endian,
+which orders the same way, so a search compares whole entries only
+among cells with equal keys. Internal index nodes use the same format:
+a cell holds a child page number followed by the largest entry under
+that child, and the right child is kept in the next leaf field.
+*/
+const uint32_t INDEX_ENTRY_LENGTH_SIZE = sizeof(uint8_t);
+const uint32_t INDEX_ENTRY_ID_SIZE = sizeof(uint32_t);
+const uint32_t INDEX_ENTRY_MAX_SIZE = INDEX_ENTRY_LENGTH_SIZE + COLUMN_EMAIL_SIZE + INDEX_ENTRY_ID_SIZE;
+const uint32_t INDEX_CHILD_SIZE = sizeof(uint32_t);
+
+typedef pair<uint32_t, string> IndexCell;   // key and payload of a cell
+
+uint32_t make_index_entry(string_view value, uint32_t id, char *entry)
+{
+    // Returns the size of the entry
+    entry[0] = (uint8_t)value.size();
+    memcpy(entry + INDEX_ENTRY_LENGTH_SIZE, value.data(), value.size());
+    memcpy(entry + INDEX_ENTRY_LENGTH_SIZE + value.size(), &id, INDEX_ENTRY_ID_SIZE);
+    return INDEX_ENTRY_LENGTH_SIZE + value.size() + INDEX_ENTRY_ID_SIZE;
+}
+
+string_view index_entry_value(const char *entry)
+{
+    return string_view(entry + INDEX_ENTRY_LENGTH_SIZE, (uint8_t)entry[0]);
+}
+
+uint32_t index_entry_id(const char *entry)
+{
+    uint32_t id;
+    memcpy(&id, entry + INDEX_ENTRY_LENGTH_SIZE + (uint8_t)entry[0], INDEX_ENTRY_ID_SIZE);
+    return id;
+}
+
+uint32_t index_entry_key(const char *entry)
+{
+    // The first four value bytes big-endian, zero padded
+    string_view value = index_entry_value(entry);
+    uint32_t key = 0;
+    for(uint32_t i = 0; i < sizeof(key); i++)
+    {
+        key = key << 8 | (i < value.size() ? (uint8_t)value[i] : 0);
+    }
+    return key;
+}
+
+int compare_index_entries(const char *a, const char *b)
+{
+    int order = index_entry_value(a).compare(index_entry_value(b));
+    if(order != 0)
+    {
+        return order;
+    }
+    uint32_t a_id = index_entry_id(a);
+    uint32_t b_id = index_entry_id(b);
+    return a_id < b_id ? -1 : a_id > b_id;
+}
+
+uint32_t index_node_find_cell(LeafNode &node, uint32_t entry_offset, const char *entry)
+{
+    /*
+    Index of the first cell whose entry is >= entry; entry_offset is
+    where the entry starts in a cell's payload. The key search finds
+    the run of cells with the same key, which is searched by entry.
+    */
+    uint32_t key = index_entry_key(entry);
+    uint32_t num_cells = *node.leaf_node_num_cells();
+    uint32_t low = key_lower_bound(node.leaf_node_keys(), num_cells, key);
+    uint32_t high = key == UINT32_MAX ? num_cells : key_lower_bound(node.leaf_node_keys(), num_cells, key + 1);
+    while(low < high)
+    {
+        uint32_t middle = (low + high) / 2;
+        if(compare_index_entries((char *)node.leaf_node_value(middle) + entry_offset, entry) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+vector<IndexCell> index_node_cells(LeafNode &node)
+{
+    vector<IndexCell> cells;
+    for(uint32_t i = 0; i < *node.leaf_node_num_cells(); i++)
+    {
+        cells.push_back(make_pair(*node.leaf_node_key(i),
+                                  string((char *)node.leaf_node_value(i), *node.leaf_node_value_size(i))));
+    }
+    return cells;
+}
+
+void index_node_write(LeafNode &node, NodeType type, bool is_root, vector<IndexCell>::iterator first,
+                      vector<IndexCell>::iterator last, uint32_t link)
+{
+    // Rebuild node from cells that are known to fit; link is the next
+    // leaf of a leaf or the right child of an internal node
+    node.initialize_leaf_node();
+    node.set_node_type(type);
+    node.set_node_root(is_root);
+    for(; first != last; first++)
+    {
+        node.leaf_node_insert_cell(*node.leaf_node_num_cells(), first->first,
+                                   first->second.data(), first->second.size());
+    }
+    *node.leaf_node_next_leaf() = link;
+}
+
+IndexCell make_index_child_cell(uint32_t child_page_num, const string &entry)
+{
+    string payload((char *)&child_page_num, INDEX_CHILD_SIZE);
+    return make_pair(index_entry_key(entry.data()), payload + entry);
+}
+
+uint32_t index_cells_bytes(const vector<IndexCell> &cells)
+{
+    uint32_t total_bytes = 0;
+    for(const IndexCell &cell : cells)
+    {
+        total_bytes += LEAF_NODE_SLOT_SIZE + cell.second.size();
+    }
+    return total_bytes;
+}
+
+uint32_t index_split_count(const vector<IndexCell> &cells, uint32_t total_bytes)
+{
+    // Number of cells for the left half when splitting cells by bytes
+    uint32_t left_count = 0;
+    uint32_t left_bytes = 0;
+    while(left_count < cells.size() - 1 &&
+          (left_count < 2 || left_bytes + LEAF_NODE_SLOT_SIZE + cells[left_count].second.size() <= total_bytes / 2))
+    {
+        left_bytes += LEAF_NODE_SLOT_SIZE + cells[left_count].second.size();
+        left_count++;
+    }
+    return left_count;
+}
+
+uint32_t index_cell_child(const IndexCell &cell)
+{
+    uint32_t child_page_num;
+    memcpy(&child_page_num, cell.second.data(), INDEX_CHILD_SIZE);
+    return child_page_num;
+}
+
+bool column_matches(string_view candidate, const string &value, bool prefix)
+{
+    // Equal to value, or for a like filter starting with it
+    return prefix ? candidate.substr(0, value.size()) == value : candidate == value;
+}
+
+string_view index_column_value(const RowView &row, IndexColumn column)
+{
+    return column == INDEX_USERNAME ? row.username() : row.email();
+}
+
+#define WAL_MAGIC 0x53444257             // "SDBW"
+#define WAL_AUTOCHECKPOINT_FRAMES 1000   // checkpoint once the log holds this many pages
+#define WAL_MARKER_PAGE UINT32_MAX       // page number of a commit frame that holds no page
+
+// WAL Layout: a header followed by frames, each a page image
+const uint32_t WAL_HEADER_SIZE = 4 * sizeof(uint32_t);        // magic, page size, salt, unused
+const uint32_t WAL_FRAME_HEADER_SIZE = 4 * sizeof(uint32_t);  // page num, db size, salt, checksum
+const uint32_t WAL_FRAME_SIZE = WAL_FRAME_HEADER_SIZE + PAGE_SIZE;
+
+uint32_t wal_checksum(const uint32_t *header, const void *page)
+{
+    // FNV-1a over the first three header words and the page image
+    uint32_t hash = 2166136261u;
+    const uint8_t *bytes = (const uint8_t *)header;
+    for(uint32_t i = 0; i < 3 * sizeof(uint32_t); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    bytes = (const uint8_t *)page;
+    for(uint32_t i = 0; i < PAGE_SIZE; i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+class Wal
+{
+    /*
+    Append-only redo log kept next to the database file. A commit
+    appends the image of every page it changed; the last frame of a
+    commit carries the database size in pages, which marks the commit
+    as complete. Only complete commits with valid checksums are
+    replayed on recovery. A large statement may spill page images
+    before its commit, as frames without the mark; they belong to the
+    commit that follows them, and are dropped if none does.
+    */
+private:
+    string filename;
+    int file_descriptor;
+    uint32_t salt;
+    uint32_t num_frames;
+    uint64_t write_offset;    // end of the appended frames
+    uint64_t base_offset;     // log bytes appended before the last reset
+    uint64_t synced_offset;   // everything before this, counted from the
+                              // first commit, is durable
+
+    // Group commit: one committer syncs on behalf of all waiting ones
+    mutex latch;
+    condition_variable synced;
+    bool sync_in_progress;
+
+    void open_log();
+    uint64_t append(vector<pair<uint32_t, void *>> &pages, uint32_t db_size, vector<uint64_t> *image_offsets);
+
+public:
+    Wal(const char *db_filename);
+
+    uint32_t recover(function<void(uint32_t, void *)> replay_page);
+    uint64_t append_commit(vector<pair<uint32_t, void *>> &pages, uint32_t db_size);
+    void append_spill(vector<pair<uint32_t, void *>> &pages, vector<uint64_t> &image_offsets);
+    void read_image(uint64_t image_offset, void *page);
+    void sync(uint64_t offset);
+    void reset();
+    void remove_log();
+    uint32_t frame_count();
+    uint64_t end_offset();
+};
+
+Wal::Wal(const char *db_filename)
+{
+    filename = string(db_filename) + "-wal";
+    file_descriptor = -1;
+    salt = 0;
+    num_frames = 0;
+    write_offset = 0;
+    base_offset = 0;
+    synced_offset = 0;
+    sync_in_progress = false;
+}
+
+void Wal::open_log()
+{
+    file_descriptor = open(filename.c_str(), O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if(file_descriptor < 0)
+    {
+        cout << "Error: cannot open log file " << filename << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+uint32_t Wal::recover(function<void(uint32_t, void *)> replay_page)
+{
+    /*
+    Hand the page images of every complete commit to replay_page and
+    return the database size in pages the last of them recorded, 0 if
+    there was none. The caller makes them durable in the database file
+    before calling reset().
+    */
+    uint32_t db_size = 0;
+    if(access(filename.c_str(), F_OK) != 0)
+    {
+        return db_size;
+    }
+    open_log();
+
+    uint32_t header[4];
+    if(pread(file_descriptor, header, WAL_HEADER_SIZE, 0) == WAL_HEADER_SIZE &&
+       header[0] == WAL_MAGIC && header[1] == PAGE_SIZE)
+    {
+        uint32_t log_salt = header[2];
+        vector<char> frame(WAL_FRAME_SIZE);
+        vector<char> pending;   // frames of the commit being read
+        uint64_t offset = WAL_HEADER_SIZE;
+
+        while(pread(file_descriptor, frame.data(), WAL_FRAME_SIZE, offset) == WAL_FRAME_SIZE)
+        {
+            uint32_t *frame_header = (uint32_t *)frame.data();
+            void *page = frame.data() + WAL_FRAME_HEADER_SIZE;
+            if(frame_header[2] != log_salt || frame_header[3] != wal_checksum(frame_header, page))
+            {
+                break;
+            }
+            pending.insert(pending.end(), frame.begin(), frame.end());
+            offset += WAL_FRAME_SIZE;
+
+            if(frame_header[1] == 0)
+            {
+                continue;
+            }
+            // Commit frame: apply the whole commit
+            for(size_t i = 0; i < pending.size(); i += WAL_FRAME_SIZE)
+            {
+                uint32_t page_num = *(uint32_t *)&pending[i];
+                if(page_num != WAL_MARKER_PAGE)
+                {
+                    replay_page(page_num, &pending[i + WAL_FRAME_HEADER_SIZE]);
+                }
+            }
+            db_size = frame_header[1];
+            pending.clear();
+        }
+    }
+    return db_size;
+}
+
+uint64_t Wal::append_commit(vector<pair<uint32_t, void *>> &pages, uint32_t db_size)
+{
+    /*
+    Append one commit with a single write. Returns the log offset that
+    must be synced for the commit to be durable. Offsets keep growing
+    across resets, so a committer still waiting when the log is reset
+    finds its commit durable. A commit whose pages were all spilled
+    ends with a frame that holds no page.
+    */
+    if(pages.empty())
+    {
+        static char empty_page[PAGE_SIZE];
+        vector<pair<uint32_t, void *>> marker(1, make_pair(WAL_MARKER_PAGE, (void *)empty_page));
+        return append(marker, db_size, nullptr);
+    }
+    return append(pages, db_size, nullptr);
+}
+
+void Wal::append_spill(vector<pair<uint32_t, void *>> &pages, vector<uint64_t> &image_offsets)
+{
+    // Append page images of a commit still in progress, and where in
+    // the log file each image starts, for read_image
+    append(pages, 0, &image_offsets);
+}
+
+void Wal::read_image(uint64_t image_offset, void *page)
+{
+    if(pread(file_descriptor, page, PAGE_SIZE, image_offset) != PAGE_SIZE)
+    {
+        cout << "Error reading log: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+uint64_t Wal::append(vector<pair<uint32_t, void *>> &pages, uint32_t db_size, vector<uint64_t> *image_offsets)
+{
+    // The last frame carries db_size, 0 for frames without a commit mark
+    unique_lock<mutex> lock(latch);
+
+    if(file_descriptor < 0)
+    {
+        open_log();
+    }
+
+    vector<char> buffer;
+    if(write_offset == 0)
+    {
+        salt = (uint32_t)time(nullptr) ^ ((uint32_t)getpid() << 16);
+        uint32_t header[4] = {WAL_MAGIC, PAGE_SIZE, salt, 0};
+        buffer.insert(buffer.end(), (char *)header, (char *)header + WAL_HEADER_SIZE);
+    }
+
+    buffer.reserve(buffer.size() + pages.size() * WAL_FRAME_SIZE);
+    for(size_t i = 0; i < pages.size(); i++)
+    {
+        uint32_t frame_header[4];
+        frame_header[0] = pages[i].first;
+        frame_header[1] = (i + 1 == pages.size()) ? db_size : 0;
+        frame_header[2] = salt;
+        frame_header[3] = wal_checksum(frame_header, pages[i].second);
+        buffer.insert(buffer.end(), (char *)frame_header, (char *)frame_header + WAL_FRAME_HEADER_SIZE);
+        if(image_offsets != nullptr)
+        {
+            image_offsets->push_back(write_offset + buffer.size());
+        }
+        buffer.insert(buffer.end(), (char *)pages[i].second, (char *)pages[i].second + PAGE_SIZE);
+    }
+
+    size_t written = 0;
+    while(written < buffer.size())
+    {
+        ssize_t result = pwrite(file_descriptor, buffer.data() + written,
+                                buffer.size() - written, write_offset + written);
+        if(result == -1)
+        {
+            cout << "Error writing log: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        written += result;
+    }
+
+    write_offset += buffer.size();
+    num_frames += pages.size();
+    return base_offset + write_offset;
+}
+
+void Wal::sync(uint64_t offset)
+{
+    /*
+    Group commit. The first committer to find the log unsynced becomes
+    the leader and issues one fdatasync covering everything appended so
+    far; committers arriving meanwhile wait for that sync, or the next,
+    instead of issuing their own.
+    */
+    unique_lock<mutex> lock(latch);
+    while(synced_offset < offset)
+    {
+        if(sync_in_progress)
+        {
+            synced.wait(lock);
+            continue;
+        }
+
+        sync_in_progress = true;
+        uint64_t target = base_offset + write_offset;
+        lock.unlock();
+        if(fdatasync(file_descriptor) == -1)
+        {
+            cout << "Error syncing log: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        lock.lock();
+        synced_offset = max(synced_offset, target);
+        sync_in_progress = false;
+        synced.notify_all();
+    }
+}
+
+void Wal::reset()
+{
+    // Called once every logged page is durable in the database file
+    unique_lock<mutex> lock(latch);
+    if(file_descriptor >= 0 && ftruncate(file_descriptor, 0) == -1)
+    {
+        cout << "Error truncating log: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    num_frames = 0;
+    base_offset += write_offset;
+    write_offset = 0;
+    synced_offset = max(synced_offset, base_offset);
+    synced.notify_all();
+}
+
+void Wal::remove_log()
+{
+    if(file_descriptor >= 0)
+    {
+        close(file_descriptor);
+        file_descriptor = -1;
+        unlink(filename.c_str());
+    }
+}
+
+uint32_t Wal::frame_count()
+{
+    unique_lock<mutex> lock(latch);
+    return num_frames;
+}
+
+uint64_t Wal::end_offset()
+{
+    // The offset to sync for everything appended so far
+    unique_lock<mutex> lock(latch);
+    return base_offset + write_offset;
+}
+
+#define COMPRESSED_MAGIC 0x5A424453       // "SDBZ"
+#define COMPRESSED_SECTOR_SIZE 256        // allocation unit for compressed pages
+#define LZ_HASH_BITS 12
+
+// Compressed file layout: a header sector, then runs of sectors holding
+// compressed pages and the page map
+const uint32_t COMPRESSED_HEADER_SIZE = 6 * sizeof(uint32_t);  // magic, page size, sector size, num pages, map sector, map sectors
+// Compressing may overshoot PAGE_SIZE by one sequence before giving up
+const uint32_t PAGE_COMPRESS_BOUND = 2 * PAGE_SIZE + 64;
+
+uint32_t lz_emit_length(uint32_t length, uint8_t *destination, uint32_t op)
+{
+    // Lengths of 15 and more continue in extra bytes, 255 meaning more follow
+    if(length < 15)
+    {
+        return op;
+    }
+    length -= 15;
+    while(length >= 255)
+    {
+        destination[op++] = 255;
+        length -= 255;
+    }
+    destination[op++] = length;
+    return op;
+}
+
+uint32_t lz_emit_sequence(const uint8_t *literals, uint32_t literal_length, uint32_t offset,
+                          uint32_t match_length, uint8_t *destination, uint32_t op)
+{
+    uint32_t match_code = match_length == 0 ? 0 : match_length - 4;
+    destination[op++] = (min(literal_length, 15u) << 4) | min(match_code, 15u);
+    op = lz_emit_length(literal_length, destination, op);
+    memcpy(destination + op, literals, literal_length);
+    op += literal_length;
+    if(match_length == 0)
+    {
+        return op;
+    }
+    destination[op++] = offset & 0xFF;
+    destination[op++] = offset >> 8;
+    return lz_emit_length(match_code, destination, op);
+}
+
+uint32_t lz_compress_page(const uint8_t *source, uint8_t *destination)
+{
+    /*
+    LZ77 in the style of LZ4. Each sequence is a token byte holding the
+    literal and match lengths, the literals, then a 2-byte offset back
+    to the match. The last sequence carries literals only. Returns the
+    compressed size, or PAGE_SIZE if the page does not shrink and
+    should be stored as is. destination needs PAGE_COMPRESS_BOUND bytes.
+    */
+    int32_t table[1 << LZ_HASH_BITS];
+    fill(table, table + (1 << LZ_HASH_BITS), -1);
+
+    const uint32_t match_limit = PAGE_SIZE - 5;
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint32_t op = 0;
+    while(ip + 4 <= match_limit)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, source + ip, 4);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int32_t ref = table[hash];
+        table[hash] = ip;
+        if(ref < 0 || memcmp(source + ref, source + ip, 4) != 0)
+        {
+            ip++;
+            continue;
+        }
+
+        uint32_t match_length = 4;
+        while(ip + match_length < match_limit && source[ref + match_length] == source[ip + match_length])
+        {
+            match_length++;
+        }
+        op = lz_emit_sequence(source + anchor, ip - anchor, ip - ref, match_length, destination, op);
+        if(op >= PAGE_SIZE)
+        {
+            return PAGE_SIZE;
+        }
+        ip += match_length;
+        anchor = ip;
+    }
+    op = lz_emit_sequence(source + anchor, PAGE_SIZE - anchor, 0, 0, destination, op);
+    return op >= PAGE_SIZE ? PAGE_SIZE : op;
+}
+
+bool lz_read_length(const uint8_t *source, uint32_t size, uint32_t &ip, uint32_t &length)
+{
+    uint8_t byte;
+    do
+    {
+        if(ip >= size)
+        {
+            return false;
+        }
+        byte = source[ip++];
+        length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+bool lz_decompress_page(const uint8_t *source, uint32_t size, uint8_t *destination)
+{
+    // Returns false if the input does not decode to exactly one page
+    uint32_t ip = 0;
+    uint32_t op = 0;
+    while(ip < size)
+    {
+        uint8_t token = source[ip++];
+        uint32_t literal_length = token >> 4;
+        if(literal_length == 15 && !lz_read_length(source, size, ip, literal_length))
+        {
+            return false;
+        }
+        if(literal_length > size - ip || literal_length > PAGE_SIZE - op)
+        {
+            return false;
+        }
+        memcpy(destination + op, source + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if(ip == size)
+        {
+            break;
+        }
+
+        if(size - ip < 2)
+        {
+            return false;
+        }
+        uint32_t offset = source[ip] | (source[ip + 1] << 8);
+        ip += 2;
+        uint32_t match_length = token & 15;
+        if(match_length == 15 && !lz_read_length(source, size, ip, match_length))
+        {
+            return false;
+        }
+        match_length += 4;
+        if(offset == 0 || offset > op || match_length > PAGE_SIZE - op)
+        {
+            return false;
+        }
+        // Byte by byte, since the match may overlap what it produces
+        for(uint32_t i = 0; i < match_length; i++)
+        {
+            destination[op + i] = destination[op - offset + i];
+        }
+        op += match_length;
+    }
+    return op == PAGE_SIZE;
+}
+
+class PageExtent
+{
+public:
+    uint32_t first_sector;
+    uint16_t capacity;   // sectors allocated to the page
+    uint16_t length;     // stored bytes, PAGE_SIZE if uncompressed, 0 if never written
+};
+
+class CompressedFile
+{
+    /*
+    Keeps each page compressed in a run of sectors, located through a
+    page map stored in the same file. A page is rewritten in place when
+    its new image fits its sectors, otherwise it moves and the old run
+    is reused by a later write of the same size. On sync the map is
+    written to fresh sectors and published by rewriting the header, so
+    a crash leaves the previous map intact; every page written since
+    that map was published is still in the log and gets replayed.
+    */
+private:
+    int file_descriptor;
+    vector<PageExtent> page_map;
+    uint32_t map_sector;
+    uint32_t map_sectors;
+    bool map_dirty;
+    uint32_t end_sector;   // first sector past everything allocated
+    unordered_map<uint32_t, vector<uint32_t>> free_runs;   // by length in sectors
+    vector<uint8_t> buffer;
+
+    // Pages are read without the pager latch, while another thread may
+    // be writing back an evicted page; this guards the map between the
+    // two. sync and truncate only run with the table held exclusively
+    mutex map_latch;
+
+    uint32_t allocate(uint32_t sectors);
+    void release(uint32_t first_sector, uint32_t sectors);
+    void write_bytes(uint64_t offset, const void *data, uint64_t length);
+    void write_header();
+
+public:
+    CompressedFile(int file_descriptor, bool create);
+
+    static bool is_compressed(int file_descriptor);
+    uint32_t page_count();
+    uint32_t read_page(uint32_t page_num, void *page);
+    uint32_t write_page(uint32_t page_num, const void *page);
+    void sync();
+    void truncate(uint32_t page_count);
+};
+
+CompressedFile::CompressedFile(int file_descriptor, bool create)
+{
+    this->file_descriptor = file_descriptor;
+    map_sector = 0;
+    map_sectors = 0;
+    map_dirty = false;
+    end_sector = 1;
+    buffer.resize(PAGE_COMPRESS_BOUND);
+    if(create)
+    {
+        write_header();
+        return;
+    }
+
+    uint32_t header[6];
+    if(pread(file_descriptor, header, COMPRESSED_HEADER_SIZE, 0) != COMPRESSED_HEADER_SIZE ||
+       header[1] != PAGE_SIZE || header[2] != COMPRESSED_SECTOR_SIZE)
+    {
+        cout << "Compressed db file has an unsupported header. Corrupt file." << endl;
+        exit(EXIT_FAILURE);
+    }
+    page_map.resize(header[3]);
+    map_sector = header[4];
+    map_sectors = header[5];
+    uint64_t map_bytes = page_map.size() * sizeof(PageExtent);
+    if(map_bytes > 0 &&
+       pread(file_descriptor, page_map.data(), map_bytes,
+             (off_t)map_sector * COMPRESSED_SECTOR_SIZE) != (ssize_t)map_bytes)
+    {
+        cout << "Error reading page map: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Runs left unreferenced by a crash are not reclaimed; new runs go past them
+    uint64_t file_length = lseek(file_descriptor, 0, SEEK_END);
+    end_sector = max((uint64_t)1, (file_length + COMPRESSED_SECTOR_SIZE - 1) / COMPRESSED_SECTOR_SIZE);
+}
+
+bool CompressedFile::is_compressed(int file_descriptor)
+{
+    // Uncompressed files start with a node type byte, which never matches
+    uint32_t magic;
+    return pread(file_descriptor, &magic, sizeof(magic), 0) == sizeof(magic) &&
+           magic == COMPRESSED_MAGIC;
+}
+
+uint32_t CompressedFile::page_count()
+{
+    return page_map.size();
+}
+
+uint32_t CompressedFile::allocate(uint32_t sectors)
+{
+    auto it = free_runs.find(sectors);
+    if(it != free_runs.end() && !it->second.empty())
+    {
+        uint32_t first_sector = it->second.back();
+        it->second.pop_back();
+        return first_sector;
+    }
+    uint32_t first_sector = end_sector;
+    end_sector += sectors;
+    return first_sector;
+}
+
+void CompressedFile::release(uint32_t first_sector, uint32_t sectors)
+{
+    free_runs[sectors].push_back(first_sector);
+}
+
+void CompressedFile::write_bytes(uint64_t offset, const void *data, uint64_t length)
+{
+    uint64_t written = 0;
+    while(written < length)
+    {
+        ssize_t result = pwrite(file_descriptor, (const char *)data + written, length - written,
+                                offset + written);
+        if(result == -1)
+        {
+            cout << "Error writing: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        written += result;
+    }
+}
+
+void CompressedFile::write_header()
+{
+    uint32_t header[6] = {COMPRESSED_MAGIC, PAGE_SIZE, COMPRESSED_SECTOR_SIZE,
+                          (uint32_t)page_map.size(), map_sector, map_sectors};
+    write_bytes(0, header, COMPRESSED_HEADER_SIZE);
+}
+
+uint32_t CompressedFile::read_page(uint32_t page_num, void *page)
+{
+    // Returns the number of bytes read from the file
+    PageExtent extent;
+    {
+        lock_guard<mutex> lock(map_latch);
+        if(page_num >= page_map.size() || page_map[page_num].length == 0)
+        {
+            memset(page, 0, PAGE_SIZE);
+            return 0;
+        }
+        extent = page_map[page_num];
+    }
+
+    uint8_t stored[PAGE_SIZE];
+    off_t offset = (off_t)extent.first_sector * COMPRESSED_SECTOR_SIZE;
+    void *target = extent.length == PAGE_SIZE ? page : stored;
+    if(pread(file_descriptor, target, extent.length, offset) != extent.length)
+    {
+        cout << "Error reading file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(extent.length != PAGE_SIZE && !lz_decompress_page(stored, extent.length, (uint8_t *)page))
+    {
+        cout << "Compressed page " << page_num << " does not decode. Corrupt file." << endl;
+        exit(EXIT_FAILURE);
+    }
+    return extent.length;
+}
+
+uint32_t CompressedFile::write_page(uint32_t page_num, const void *page)
+{
+    // Returns the number of bytes written to the file
+    lock_guard<mutex> lock(map_latch);
+    uint32_t length = lz_compress_page((const uint8_t *)page, buffer.data());
+    const void *data = length == PAGE_SIZE ? page : buffer.data();
+    uint32_t sectors = (length + COMPRESSED_SECTOR_SIZE - 1) / COMPRESSED_SECTOR_SIZE;
+
+    if(page_num >= page_map.size())
+    {
+        page_map.resize(page_num + 1, PageExtent{0, 0, 0});
+    }
+    PageExtent &extent = page_map[page_num];
+    if(extent.capacity < sectors)
+    {
+        if(extent.capacity > 0)
+        {
+            release(extent.first_sector, extent.capacity);
+        }
+        extent.first_sector = allocate(sectors);
+        extent.capacity = sectors;
+    }
+    extent.length = length;
+    map_dirty = true;
+
+    write_bytes((uint64_t)extent.first_sector * COMPRESSED_SECTOR_SIZE, data, length);
+    return length;
+}
+
+void CompressedFile::sync()
+{
+    /*
+    Make the written pages durable, then publish the map: write it to
+    new sectors, sync, point the header at it and sync again. The old
+    map's sectors are only reused after the header moves on.
+    */
+    if(fdatasync(file_descriptor) == -1)
+    {
+        cout << "Error syncing db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(!map_dirty)
+    {
+        return;
+    }
+
+    uint64_t map_bytes = page_map.size() * sizeof(PageExtent);
+    uint32_t sectors = max((uint64_t)1, (map_bytes + COMPRESSED_SECTOR_SIZE - 1) / COMPRESSED_SECTOR_SIZE);
+    uint32_t new_map_sector = allocate(sectors);
+    write_bytes((uint64_t)new_map_sector * COMPRESSED_SECTOR_SIZE, page_map.data(), map_bytes);
+    if(fdatasync(file_descriptor) == -1)
+    {
+        cout << "Error syncing db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t old_map_sector = map_sector;
+    uint32_t old_map_sectors = map_sectors;
+    map_sector = new_map_sector;
+    map_sectors = sectors;
+    write_header();
+    if(fdatasync(file_descriptor) == -1)
+    {
+        cout << "Error syncing db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(old_map_sectors > 0)
+    {
+        release(old_map_sector, old_map_sectors);
+    }
+    map_dirty = false;
+}
+
+void CompressedFile::truncate(uint32_t page_count)
+{
+    /*
+    Drop the pages from page_count on and publish the shorter map, then
+    cut the file after the last sector still in use. Free runs past
+    that point go with it.
+    */
+    for(uint32_t page_num = page_count; page_num < page_map.size(); page_num++)
+    {
+        if(page_map[page_num].capacity > 0)
+        {
+            release(page_map[page_num].first_sector, page_map[page_num].capacity);
+        }
+    }
+    page_map.resize(min((size_t)page_count, page_map.size()));
+    map_dirty = true;
+    sync();
+
+    uint32_t used_end = map_sector + map_sectors;
+    for(PageExtent &extent : page_map)
+    {
+        if(extent.capacity > 0)
+        {
+            used_end = max(used_end, extent.first_sector + extent.capacity);
+        }
+    }
+    used_end = max(used_end, (uint32_t)1);
+    for(auto &runs : free_runs)
+    {
+        vector<uint32_t> &first_sectors = runs.second;
+        first_sectors.erase(remove_if(first_sectors.begin(), first_sectors.end(),
+                                      [used_end](uint32_t first_sector) { return first_sector >= used_end; }),
+                            first_sectors.end());
+    }
+    if(ftruncate(file_descriptor, (off_t)used_end * COMPRESSED_SECTOR_SIZE) == -1)
+    {
+        cout << "Error truncating db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    end_sector = used_end;
+}
+
+#define ASYNC_READ_QUEUE_DEPTH 64   // reads in flight at most with io_uring
+#define ASYNC_READ_THREADS 4        // threads issuing reads without io_uring
+
+class AsyncReader
+{
+    /*
+    Reads whole pages in the background into buffers the caller keeps
+    until the read is done. Each read carries a tag, and wait() blocks
+    until the read with that tag has landed. Reads go through io_uring
+    when the kernel offers it, so a batch of them is queued without
+    waiting on any; otherwise a few threads issue them with pread. The
+    pager submits with its latch held but waits without it, so several
+    threads may wait at once; the reader's own latch guards the rings
+    and the completions, and one waiter at a time blocks in the kernel
+    for the next completion while the others wait for it to hand them
+    theirs.
+    */
+private:
+    int file_descriptor;
+    unordered_map<uint32_t, int> completed;   // tag to bytes read or -errno
+
+    // io_uring: the submission and completion rings shared with the
+    // kernel. ring_fd is -1 when the threads are used instead
+    int ring_fd;
+    uint32_t in_flight;
+    bool reaping;   // a waiter is collecting completions from the ring
+#ifdef HAVE_IO_URING
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    io_uring_cqe *cqes;
+#endif
+
+    // Thread pool fallback
+    struct Request
+    {
+        uint32_t tag;
+        void *buffer;
+        uint64_t offset;
+    };
+    deque<Request> requests;
+    vector<thread> workers;
+    mutex latch;
+    condition_variable changed;
+    bool stopping;
+
+    bool setup_ring();
+    void reap_completions(unique_lock<mutex> &lock);
+    void work();
+
+public:
+    AsyncReader(int file_descriptor);
+    ~AsyncReader();
+
+    void read(uint32_t tag, void *buffer, uint64_t offset);
+    void wait(uint32_t tag);
+};
+
+AsyncReader::AsyncReader(int file_descriptor)
+{
+    this->file_descriptor = file_descriptor;
+    in_flight = 0;
+    reaping = false;
+    stopping = false;
+    if(!setup_ring())
+    {
+        for(uint32_t i = 0; i < ASYNC_READ_THREADS; i++)
+        {
+            workers.emplace_back(&AsyncReader::work, this);
+        }
+    }
+}
+
+AsyncReader::~AsyncReader()
+{
+    // Reads still in flight write into buffers about to be freed
+    {
+        unique_lock<mutex> lock(latch);
+        while(ring_fd >= 0 && in_flight > 0)
+        {
+            reap_completions(lock);
+        }
+        changed.wait(lock, [this] { return in_flight == 0; });
+        stopping = true;
+    }
+    changed.notify_all();
+    for(thread &worker : workers)
+    {
+        worker.join();
+    }
+#ifdef HAVE_IO_URING
+    if(ring_fd >= 0)
+    {
+        munmap(sqes, sqes_size);
+        munmap(cq_ring, cq_ring_size);
+        munmap(sq_ring, sq_ring_size);
+        close(ring_fd);
+    }
+#endif
+}
+
+bool AsyncReader::setup_ring()
+{
+    // False if io_uring is missing or not allowed, e.g. by seccomp
+    ring_fd = -1;
+#ifdef HAVE_IO_URING
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, ASYNC_READ_QUEUE_DEPTH, &params);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes_map == MAP_FAILED)
+    {
+        for(pair<void *, size_t> map : {make_pair(sq_ring, sq_ring_size), make_pair(cq_ring, cq_ring_size),
+                                        make_pair(sqes_map, sqes_size)})
+        {
+            if(map.first != MAP_FAILED)
+            {
+                munmap(map.first, map.second);
+            }
+        }
+        close(fd);
+        return false;
+    }
+
+    char *sq = (char *)sq_ring;
+    char *cq = (char *)cq_ring;
+    sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + params.sq_off.array);
+    cq_head = (unsigned *)(cq + params.cq_off.head);
+    cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    sqes = (io_uring_sqe *)sqes_map;
+    ring_fd = fd;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void AsyncReader::read(uint32_t tag, void *buffer, uint64_t offset)
+{
+#ifdef HAVE_IO_URING
+    if(ring_fd >= 0)
+    {
+        // Keep the completion ring from overflowing
+        unique_lock<mutex> lock(latch);
+        while(in_flight >= ASYNC_READ_QUEUE_DEPTH)
+        {
+            reap_completions(lock);
+        }
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = file_descriptor;
+        sqe.addr = (uint64_t)buffer;
+        sqe.len = PAGE_SIZE;
+        sqe.off = offset;
+        sqe.user_data = tag;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        while(syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0) < 0)
+        {
+            if(errno != EINTR)
+            {
+                cout << "Error queueing read: " << errno << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+        in_flight++;
+        return;
+    }
+#endif
+    {
+        lock_guard<mutex> lock(latch);
+        requests.push_back({tag, buffer, offset});
+        in_flight++;
+    }
+    changed.notify_all();
+}
+
+void AsyncReader::reap_completions(unique_lock<mutex> &lock)
+{
+    // Move finished reads from the completion ring to completed, first
+    // waiting for one with the latch let go. If another thread is
+    // already doing that, wait for it to finish instead
+#ifdef HAVE_IO_URING
+    if(reaping)
+    {
+        changed.wait(lock);
+        return;
+    }
+    reaping = true;
+    if(*cq_head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        lock.unlock();
+        int result = syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        int error = errno;
+        lock.lock();
+        if(result < 0 && error != EINTR)
+        {
+            cout << "Error waiting for reads: " << error << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    unsigned head = *cq_head;
+    while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        io_uring_cqe &cqe = cqes[head & *cq_mask];
+        completed[cqe.user_data] = cqe.res;
+        in_flight--;
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    reaping = false;
+    changed.notify_all();
+#endif
+}
+
+void AsyncReader::wait(uint32_t tag)
+{
+    int result;
+    {
+        unique_lock<mutex> lock(latch);
+        while(completed.find(tag) == completed.end())
+        {
+            if(ring_fd >= 0)
+            {
+                reap_completions(lock);
+            }
+            else
+            {
+                changed.wait(lock);
+            }
+        }
+        result = completed[tag];
+        completed.erase(tag);
+    }
+    if(result < 0)
+    {
+        cout << "Error reading file: " << -result << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void AsyncReader::work()
+{
+    unique_lock<mutex> lock(latch);
+    while(true)
+    {
+        changed.wait(lock, [this] { return stopping || !requests.empty(); });
+        if(requests.empty())
+        {
+            return;
+        }
+        Request request = requests.front();
+        requests.pop_front();
+        lock.unlock();
+        ssize_t bytes_read = pread(file_descriptor, request.buffer, PAGE_SIZE, request.offset);
+        lock.lock();
+        completed[request.tag] = bytes_read < 0 ? -errno : bytes_read;
+        in_flight--;
+        changed.notify_all();
+    }
+}
+
+class Counters
+{
+    /*
+    The running totals behind Stats. Threads bump them from under
+    different latches, or none, and they are only read for reporting,
+    so they are relaxed atomics.
+    */
+public:
+    atomic<uint64_t> cache_hits{0};
+    atomic<uint64_t> cache_misses{0};
+    atomic<uint64_t> pages_read{0};
+    atomic<uint64_t> pages_read_ahead{0};
+    atomic<uint64_t> pages_written{0};
+    atomic<uint64_t> pages_flushed{0};
+    atomic<uint64_t> pages_logged{0};
+    atomic<uint64_t> bytes_read{0};
+    atomic<uint64_t> bytes_written{0};
+    atomic<uint64_t> leaf_splits{0};
+    atomic<uint64_t> internal_splits{0};
+    atomic<uint64_t> root_splits{0};
+    atomic<uint64_t> rows_examined{0};
+    atomic<uint64_t> io_nanoseconds{0};
+
+    // Whether I/O is timed; reading the clock is the costly part
+    atomic<bool> timing{false};
+
+    static void add(atomic<uint64_t> &counter, uint64_t amount = 1)
+    {
+        counter.fetch_add(amount, memory_order_relaxed);
+    }
+
+    void copy_to(Stats &stats)
+    {
+        stats.cache_hits = cache_hits.load(memory_order_relaxed);
+        stats.cache_misses = cache_misses.load(memory_order_relaxed);
+        stats.pages_read = pages_read.load(memory_order_relaxed);
+        stats.pages_read_ahead = pages_read_ahead.load(memory_order_relaxed);
+        stats.pages_written = pages_written.load(memory_order_relaxed);
+        stats.pages_flushed = pages_flushed.load(memory_order_relaxed);
+        stats.pages_logged = pages_logged.load(memory_order_relaxed);
+        stats.bytes_read = bytes_read.load(memory_order_relaxed);
+        stats.bytes_written = bytes_written.load(memory_order_relaxed);
+        stats.leaf_splits = leaf_splits.load(memory_order_relaxed);
+        stats.internal_splits = internal_splits.load(memory_order_relaxed);
+        stats.root_splits = root_splits.load(memory_order_relaxed);
+        stats.rows_examined = rows_examined.load(memory_order_relaxed);
+        stats.io_nanoseconds = io_nanoseconds.load(memory_order_relaxed);
+    }
+};
+
+class IoTimer
+{
+    /*
+    Adds the time from its creation to the end of its scope to
+    io_nanoseconds, if timing is on; otherwise it costs a flag check.
+    Timers go around the calls that wait on the disk and never nest.
+    */
+private:
+    Counters &counters;
+    bool timing;
+    chrono::steady_clock::time_point start;
+
+public:
+    IoTimer(Counters &counters) : counters(counters)
+    {
+        timing = counters.timing.load(memory_order_relaxed);
+        if(timing)
+        {
+            start = chrono::steady_clock::now();
+        }
+    }
+
+    ~IoTimer()
+    {
+        if(timing)
+        {
+            auto elapsed = chrono::steady_clock::now() - start;
+            Counters::add(counters.io_nanoseconds, chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+        }
+    }
+};
+
+#define READ_AHEAD_PAGES 16                // leaves a scan keeps requested ahead of it
+#define BULK_LOAD_CHUNK_PAGES 256          // pages per write when bulk loading
+#define MIN_POOL_SIZE 16
+#define MMAP_RESERVE_SIZE (1ULL << 36)   // address space reserved for the mapping
+#define MMAP_GROWTH_PAGES 256            // pages added to the file per extension
+const uint32_t INVALID_PAGE_NUM = UINT32_MAX;
+
+class Frame
+{
+public:
+    uint32_t page_num;
+    uint32_t pin_count;
+    bool referenced;
+    bool dirty;         // differs from the database file
+    bool uncommitted;   // changed since the last commit, must not be evicted
+    bool loading;       // page is still being read or written back, see Pager::wait_for_read
+    bool read_ahead;    // the read was queued on the reader and not waited for
+    bool spilled;       // logged before its commit, must not reach the database file
+    void *page;
+
+    // Signalled when loading is cleared, under the pager latch
+    condition_variable loaded;
+
+    Frame()
+    {
+        page_num = INVALID_PAGE_NUM;
+        pin_count = 0;
+        referenced = false;
+        dirty = false;
+        uncommitted = false;
+        loading = false;
+        read_ahead = false;
+        spilled = false;
+        page = nullptr;
+    }
+};
+
+class Pager
+{
+private:
+    int file_descriptor;
+    uint64_t file_length;
+    uint32_t num_pages;
+    PagerBackend backend;
+
+    // Buffer pool: a fixed set of frames plus a page table mapping
+    // page numbers to the frame that currently holds them. The latch
+    // guards both, so threads reading the tree can pin pages at once.
+    // It is let go while a page is read from disk.
+    mutex latch;
+    uint32_t pool_size;
+    vector<Frame> frames;
+    unordered_map<uint32_t, uint32_t> page_table;
+    uint32_t clock_hand;
+
+    // Memory-mapped backend: the file is mapped at the start of a
+    // reserved address range so pointers stay valid while it grows.
+    char *map_base;
+    uint64_t map_length;
+    set<uint32_t> dirty_mapped_pages;
+
+    // Write-ahead log, used by the buffer pool backend only
+    Wal *wal;
+    vector<uint32_t> uncommitted_pages;
+
+    // Pages spilled to the log by the statement in progress, see
+    // spill(), and where in the log the latest image of each page
+    // spilled since the last checkpoint is, until the page is written
+    // to the database file. Pages out of the pool are read from there
+    unordered_set<uint32_t> spilled_pages;
+    unordered_map<uint32_t, uint64_t> log_images;
+
+    // Set when pages are stored compressed, buffer pool backend only
+    CompressedFile *compressed;
+
+    // Reads pages ahead of use, buffer pool backend without compression
+    AsyncReader *reader;
+
+    uint32_t find_victim_frame(unique_lock<mutex> &lock, bool required);
+    uint32_t claim_frame(unique_lock<mutex> &lock, bool required);
+    void wait_for_read(unique_lock<mutex> &lock, uint32_t frame_num);
+    void write_frame(Frame &frame);
+    void write_run(vector<Frame *> &run);
+    void write_pages(vector<Frame *> &run);
+    void write_back(unique_lock<mutex> &lock, uint32_t frame_num);
+    void write_page_image(uint32_t page_num, void *page);
+    void map_file();
+    void grow_mapping(uint32_t page_num);
+
+public:
+    Pager(const char *filename, uint32_t pool_size, PagerBackend backend, bool compress);
+
+    void *get_page(uint32_t page_num);
+    void prefetch(uint32_t page_num);
+    void unpin_page(uint32_t page_num);
+    void mark_dirty(uint32_t page_num);
+    void pager_flush(uint32_t page_num);
+    void flush_dirty_pages();
+    void pager_sync();
+    void spill();
+    uint64_t log_commit(bool may_checkpoint = true);
+    bool checkpoint_due();
+    void wait_commit(uint64_t offset);
+    void commit();
+    void checkpoint();
+    void pager_close();
+    void print_tree(uint32_t page_num, uint32_t indentation_level);
+    uint32_t get_unused_page_num();
+    void write_new_pages(uint32_t first_page_num, void *pages, uint32_t count);
+    void resize_file(uint32_t page_count);
+    void truncate(uint32_t page_count);
+
+    // Atomic, so anything holding the pager may count into them
+    Counters counters;
+
+    friend class Table;
+};
+
+Pager::Pager(const char *filename, uint32_t pool_size, PagerBackend backend, bool compress)
+{
+    file_descriptor = open(filename,
+                           O_RDWR |       // Read/Write mode
+                               O_CREAT,   // Create file if it does not exist
+                           S_IWUSR |      // User write permission
+                               S_IRUSR    // User read permission
+    );
+    if(file_descriptor < 0)
+    {
+        cerr << "Error: cannot open file " << filename << endl;
+        exit(EXIT_FAILURE);
+    }
+    this->backend = backend;
+    map_base = nullptr;
+    map_length = 0;
+    file_length = 0;
+
+    // Compression is chosen when the file is created and detected after
+    compressed = nullptr;
+    bool is_compressed = CompressedFile::is_compressed(file_descriptor);
+    if(compress || is_compressed)
+    {
+        if(backend == PAGER_MMAP)
+        {
+            cout << "Error: compressed databases cannot use the mmap backend." << endl;
+            exit(EXIT_FAILURE);
+        }
+        if(!is_compressed && lseek(file_descriptor, 0, SEEK_END) != 0)
+        {
+            cout << "Error: --compress needs a new database file." << endl;
+            exit(EXIT_FAILURE);
+        }
+        compressed = new CompressedFile(file_descriptor, !is_compressed);
+    }
+
+    // A log left by a crash is replayed whatever the backend; only the
+    // buffer pool keeps logging, the mmap backend drops the log
+    wal = new Wal(filename);
+    uint32_t db_size = wal->recover([this](uint32_t page_num, void *page) {
+        write_page_image(page_num, page);
+    });
+    if(db_size != 0)
+    {
+        resize_file(db_size);
+    }
+    pager_sync();
+    wal->reset();
+    if(backend != PAGER_BUFFER_POOL)
+    {
+        wal->remove_log();
+        delete wal;
+        wal = nullptr;
+    }
+
+    if(compressed != nullptr)
+    {
+        file_length = 0;
+        num_pages = compressed->page_count();
+    }
+    else
+    {
+        file_length = lseek(file_descriptor, 0, SEEK_END);
+        num_pages = file_length / PAGE_SIZE;
+    }
+
+    if(file_length % PAGE_SIZE != 0)
+    {
+        cerr << "Db file is not a whole number of pages. Corrupt file." << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    reader = nullptr;
+    if(backend == PAGER_MMAP)
+    {
+        this->pool_size = 0;
+        clock_hand = 0;
+        map_file();
+        return;
+    }
+
+    this->pool_size = pool_size < MIN_POOL_SIZE ? MIN_POOL_SIZE : pool_size;
+    frames = vector<Frame>(this->pool_size);
+    page_table.reserve(this->pool_size);
+    clock_hand = 0;
+    reader = compressed == nullptr ? new AsyncReader(file_descriptor) : nullptr;
+}
+
+void Pager::map_file()
+{
+    void *reserved = mmap(nullptr, MMAP_RESERVE_SIZE, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(reserved == MAP_FAILED)
+    {
+        cout << "Error reserving address space: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    map_base = (char *)reserved;
+
+    if(file_length > 0)
+    {
+        void *mapped = mmap(map_base, file_length, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_FIXED, file_descriptor, 0);
+        if(mapped == MAP_FAILED)
+        {
+            cout << "Error mapping db file: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        map_length = file_length;
+    }
+}
+
+void Pager::grow_mapping(uint32_t page_num)
+{
+    /*
+    Extend the file and the mapping so page_num is covered. The new
+    range is mapped with MAP_FIXED directly behind the current one
+    inside the reservation, rather than with mremap, because a moving
+    mremap would invalidate the page pointers held by callers.
+    */
+    uint64_t new_length = ((uint64_t)page_num + MMAP_GROWTH_PAGES) * PAGE_SIZE;
+    if(new_length > MMAP_RESERVE_SIZE)
+    {
+        cout << "Tried to map page beyond the reserved address space. " << page_num << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(ftruncate(file_descriptor, new_length) == -1)
+    {
+        cout << "Error extending db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    void *mapped = mmap(map_base + map_length, new_length - map_length,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                        file_descriptor, map_length);
+    if(mapped == MAP_FAILED)
+    {
+        cout << "Error mapping db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    map_length = new_length;
+}
+
+uint32_t Pager::find_victim_frame(unique_lock<mutex> &lock, bool required)
+{
+    /*
+    CLOCK replacement. Free frames are taken first. Otherwise sweep the
+    hand over the frames, clearing reference bits, until an unpinned
+    frame without its reference bit is found. Two full sweeps without
+    a candidate means every frame is pinned, which is fatal if a frame
+    is required and returns INVALID_PAGE_NUM otherwise. Pages changed
+    since the last commit stay resident so uncommitted data never
+    reaches the database file. A read-ahead still in flight is waited
+    for with the latch let go, after which the frame may be in use.
+    */
+    for(uint32_t step = 0; step < 2 * pool_size; step++)
+    {
+        Frame &frame = frames[clock_hand];
+        uint32_t frame_num = clock_hand;
+        clock_hand = (clock_hand + 1) % pool_size;
+
+        if(frame.page_num == INVALID_PAGE_NUM)
+        {
+            return frame_num;
+        }
+        if(frame.pin_count > 0 || frame.uncommitted)
+        {
+            continue;
+        }
+        if(frame.referenced)
+        {
+            frame.referenced = false;
+            continue;
+        }
+        if(frame.loading)
+        {
+            frame.pin_count++;
+            wait_for_read(lock, frame_num);
+            frame.pin_count--;
+            if(frame.pin_count > 0 || frame.referenced)
+            {
+                continue;
+            }
+        }
+        return frame_num;
+    }
+
+    if(!required)
+    {
+        return INVALID_PAGE_NUM;
+    }
+    cout << "Buffer pool exhausted: all " << pool_size << " frames are pinned or uncommitted." << endl;
+    exit(EXIT_FAILURE);
+}
+
+void *Pager::get_page(uint32_t page_num)
+{
+    /*
+    Returns the page pinned. Every call must be matched by unpin_page()
+    once the caller no longer touches the page, otherwise the frame can
+    never be evicted. On a miss the frame is taken, pinned and marked
+    loading, and the latch is let go for the read, so other threads
+    keep hitting the pool; one that wants the same page waits for the
+    frame instead of reading it again.
+    */
+    if(backend == PAGER_MMAP)
+    {
+        if((uint64_t)(page_num + 1) * PAGE_SIZE > map_length)
+        {
+            grow_mapping(page_num);
+        }
+        if(page_num >= num_pages)
+        {
+            num_pages = page_num + 1;
+        }
+        return map_base + (uint64_t)page_num * PAGE_SIZE;
+    }
+
+    unique_lock<mutex> lock(latch);
+    uint32_t frame_num;
+    while(true)
+    {
+        auto it = page_table.find(page_num);
+        if(it != page_table.end())
+        {
+            Frame &frame = frames[it->second];
+            frame.pin_count += 1;
+            frame.referenced = true;
+            Counters::add(counters.cache_hits);
+            if(frame.loading)
+            {
+                wait_for_read(lock, it->second);
+            }
+            return frame.page;
+        }
+
+        // Taking a frame may let go of the latch, and another thread
+        // may have brought the page in meanwhile
+        frame_num = claim_frame(lock, true);
+        if(page_table.find(page_num) == page_table.end())
+        {
+            break;
+        }
+    }
+
+    // Cache miss
+    Counters::add(counters.cache_misses);
+    Frame &frame = frames[frame_num];
+    frame.page_num = page_num;
+    frame.pin_count = 1;
+    frame.referenced = true;
+    frame.dirty = false;
+    frame.uncommitted = false;
+    page_table[page_num] = frame_num;
+    if(page_num >= num_pages)
+    {
+        num_pages = page_num + 1;
+    }
+
+    // A page whose latest image is only in the log comes from there,
+    // and is still to be written to the database file
+    auto logged = log_images.find(page_num);
+    uint64_t image_offset = 0;
+    if(logged != log_images.end())
+    {
+        image_offset = logged->second;
+        frame.dirty = true;
+        frame.spilled = spilled_pages.count(page_num) > 0;
+    }
+    else if(compressed == nullptr && page_num >= file_length / PAGE_SIZE)
+    {
+        // A new page, nothing to read
+        return frame.page;
+    }
+
+    frame.loading = true;
+    lock.unlock();
+    ssize_t bytes_read;
+    {
+        IoTimer io_timer(counters);
+        if(image_offset != 0)
+        {
+            wal->read_image(image_offset, frame.page);
+            bytes_read = PAGE_SIZE;
+        }
+        else if(compressed != nullptr)
+        {
+            bytes_read = compressed->read_page(page_num, frame.page);
+        }
+        else
+        {
+            bytes_read = pread(file_descriptor, frame.page, PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
+        }
+    }
+    if(bytes_read == -1)
+    {
+        cout << "Error reading file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(bytes_read > 0)
+    {
+        Counters::add(counters.pages_read);
+        Counters::add(counters.bytes_read, bytes_read);
+    }
+
+    lock.lock();
+    frame.loading = false;
+    frame.loaded.notify_all();
+    return frame.page;
+}
+
+uint32_t Pager::claim_frame(unique_lock<mutex> &lock, bool required)
+{
+    /*
+    Take a frame for a new page, writing back its old page if dirty.
+    The page is zeroed. The latch must be held, and is let go while
+    waiting for a read ahead or writing back; a victim that some thread
+    took up meanwhile is passed over for another.
+    */
+    uint32_t frame_num;
+    while(true)
+    {
+        frame_num = find_victim_frame(lock, required);
+        if(frame_num == INVALID_PAGE_NUM)
+        {
+            return frame_num;
+        }
+        // A spilled page is dropped, its image stays in the log
+        Frame &victim = frames[frame_num];
+        if(victim.page_num == INVALID_PAGE_NUM || !victim.dirty || victim.spilled)
+        {
+            break;
+        }
+        write_back(lock, frame_num);
+        if(victim.pin_count == 0 && !victim.referenced && !victim.dirty)
+        {
+            break;
+        }
+    }
+    Frame &frame = frames[frame_num];
+    if(frame.page_num != INVALID_PAGE_NUM)
+    {
+        page_table.erase(frame.page_num);
+        frame.page_num = INVALID_PAGE_NUM;
+        frame.spilled = false;
+    }
+    if(frame.page == nullptr)
+    {
+        frame.page = malloc(PAGE_SIZE);
+    }
+    memset(frame.page, 0, PAGE_SIZE);
+    return frame_num;
+}
+
+void Pager::prefetch(uint32_t page_num)
+{
+    /*
+    Start reading a page into the pool without waiting for it, so that
+    a later get_page finds it there or in flight. Does nothing if the
+    page is cached, lies past the end of the file, or every frame is
+    busy. The mmap backend asks the kernel to read the page ahead
+    instead; compressed pages are not read ahead.
+    */
+    if(backend == PAGER_MMAP)
+    {
+        if((uint64_t)(page_num + 1) * PAGE_SIZE <= map_length)
+        {
+            madvise(map_base + (uint64_t)page_num * PAGE_SIZE, PAGE_SIZE, MADV_WILLNEED);
+        }
+        return;
+    }
+    if(reader == nullptr)
+    {
+        return;
+    }
+
+    unique_lock<mutex> lock(latch);
+    if(page_num >= file_length / PAGE_SIZE || page_table.find(page_num) != page_table.end() ||
+       log_images.find(page_num) != log_images.end())
+    {
+        return;
+    }
+    uint32_t frame_num = claim_frame(lock, false);
+    if(frame_num == INVALID_PAGE_NUM || page_table.find(page_num) != page_table.end())
+    {
+        return;
+    }
+    Frame &frame = frames[frame_num];
+    reader->read(frame_num, frame.page, (uint64_t)page_num * PAGE_SIZE);
+    Counters::add(counters.pages_read);
+    Counters::add(counters.pages_read_ahead);
+    Counters::add(counters.bytes_read, PAGE_SIZE);
+
+    // Referenced, so the next read ahead does not evict it before use
+    frame.page_num = page_num;
+    frame.pin_count = 0;
+    frame.referenced = true;
+    frame.dirty = false;
+    frame.uncommitted = false;
+    frame.loading = true;
+    frame.read_ahead = true;
+    page_table[page_num] = frame_num;
+}
+
+void Pager::wait_for_read(unique_lock<mutex> &lock, uint32_t frame_num)
+{
+    /*
+    Wait until the page in a loading frame has been read or written
+    back. The caller holds the latch and a pin on the frame, which
+    keeps the frame from being reused while the latch is let go. The
+    first thread to want a read ahead collects it from the reader,
+    without the latch, so other threads keep using the pool; everyone
+    else waits for the frame's loaded signal.
+    */
+    IoTimer io_timer(counters);
+    Frame &frame = frames[frame_num];
+    if(frame.read_ahead)
+    {
+        frame.read_ahead = false;
+        lock.unlock();
+        reader->wait(frame_num);
+        lock.lock();
+        frame.loading = false;
+        frame.loaded.notify_all();
+        return;
+    }
+    frame.loaded.wait(lock, [&frame] { return !frame.loading; });
+}
+
+void Pager::unpin_page(uint32_t page_num)
+{
+    if(backend == PAGER_MMAP)
+    {
+        return;
+    }
+
+    lock_guard<mutex> lock(latch);
+    auto it = page_table.find(page_num);
+    if(it == page_table.end() || frames[it->second].pin_count == 0)
+    {
+        cout << "Tried to unpin page " << page_num << " that is not pinned" << endl;
+        exit(EXIT_FAILURE);
+    }
+    frames[it->second].pin_count -= 1;
+}
+
+void Pager::mark_dirty(uint32_t page_num)
+{
+    // Inserts beside each other mark their pages at the same time
+    lock_guard<mutex> lock(latch);
+    if(backend == PAGER_MMAP)
+    {
+        dirty_mapped_pages.insert(page_num);
+        return;
+    }
+
+    auto it = page_table.find(page_num);
+    if(it == page_table.end() || frames[it->second].pin_count == 0)
+    {
+        cout << "Tried to dirty page " << page_num << " that is not pinned" << endl;
+        exit(EXIT_FAILURE);
+    }
+    Frame &frame = frames[it->second];
+    frame.dirty = true;
+    if(wal != nullptr && !frame.uncommitted)
+    {
+        frame.uncommitted = true;
+        uncommitted_pages.push_back(page_num);
+    }
+}
+
+void Pager::write_frame(Frame &frame)
+{
+    vector<Frame *> run(1, &frame);
+    write_run(run);
+}
+
+void Pager::write_run(vector<Frame *> &run)
+{
+    // Write back pages with consecutive page numbers, with the latch held
+    for(Frame *frame : run)
+    {
+        log_images.erase(frame->page_num);
+    }
+    write_pages(run);
+    for(Frame *frame : run)
+    {
+        frame->dirty = false;
+    }
+    uint64_t end_of_run = (uint64_t)(run.back()->page_num + 1) * PAGE_SIZE;
+    file_length = max(file_length, end_of_run);
+}
+
+void Pager::write_pages(vector<Frame *> &run)
+{
+    /*
+    Write pages with consecutive page numbers using a single pwritev
+    call, retrying on short writes. Compressed pages no longer line up
+    with their page numbers and are written one at a time. A commit may
+    still be waiting for its log sync, which has to come first. Only
+    the I/O, so it needs no latch as long as the pages stay put.
+    */
+    IoTimer io_timer(counters);
+    if(wal != nullptr)
+    {
+        wal->sync(wal->end_offset());
+    }
+    Counters::add(counters.pages_written, run.size());
+    if(compressed != nullptr)
+    {
+        for(Frame *frame : run)
+        {
+            Counters::add(counters.bytes_written, compressed->write_page(frame->page_num, frame->page));
+        }
+        return;
+    }
+    Counters::add(counters.bytes_written, run.size() * PAGE_SIZE);
+
+    vector<struct iovec> iov(run.size());
+    for(size_t i = 0; i < run.size(); i++)
+    {
+        iov[i].iov_base = run[i]->page;
+        iov[i].iov_len = PAGE_SIZE;
+    }
+
+    off_t offset = (off_t)run[0]->page_num * PAGE_SIZE;
+    size_t first = 0;
+    while(first < iov.size())
+    {
+        ssize_t bytes_written = pwritev(file_descriptor, &iov[first], iov.size() - first, offset);
+        if(bytes_written == -1)
+        {
+            cout << "Error writing: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        offset += bytes_written;
+        while(first < iov.size() && (size_t)bytes_written >= iov[first].iov_len)
+        {
+            bytes_written -= iov[first].iov_len;
+            first++;
+        }
+        if(first < iov.size())
+        {
+            iov[first].iov_base = (char *)iov[first].iov_base + bytes_written;
+            iov[first].iov_len -= bytes_written;
+        }
+    }
+}
+
+void Pager::write_back(unique_lock<mutex> &lock, uint32_t frame_num)
+{
+    /*
+    Write back the dirty page of a frame chosen for eviction without the
+    latch, which may wait for the log sync as well as the write. The
+    frame is pinned and marked loading meanwhile, like a frame being
+    read, so it is not chosen again and threads wanting its page wait
+    for it rather than see it half written or change it under the write.
+    */
+    Frame &frame = frames[frame_num];
+    frame.pin_count++;
+    frame.loading = true;
+    log_images.erase(frame.page_num);
+    lock.unlock();
+    vector<Frame *> run(1, &frame);
+    write_pages(run);
+    lock.lock();
+    frame.dirty = false;
+    file_length = max(file_length, (uint64_t)(frame.page_num + 1) * PAGE_SIZE);
+    frame.loading = false;
+    frame.pin_count--;
+    frame.loaded.notify_all();
+}
+
+void Pager::write_page_image(uint32_t page_num, void *page)
+{
+    // Write one page image that is not held in a frame
+    IoTimer io_timer(counters);
+    Counters::add(counters.pages_written);
+    if(compressed != nullptr)
+    {
+        Counters::add(counters.bytes_written, compressed->write_page(page_num, page));
+        return;
+    }
+    Counters::add(counters.bytes_written, PAGE_SIZE);
+    if(pwrite(file_descriptor, page, PAGE_SIZE, (off_t)page_num * PAGE_SIZE) != PAGE_SIZE)
+    {
+        cout << "Error writing: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+    file_length = max(file_length, (uint64_t)(page_num + 1) * PAGE_SIZE);
+}
+
+void Pager::pager_flush(uint32_t page_num)
+{
+    if(backend == PAGER_MMAP)
+    {
+        IoTimer io_timer(counters);
+        if(msync(map_base + (uint64_t)page_num * PAGE_SIZE, PAGE_SIZE, MS_ASYNC) == -1)
+        {
+            cout << "Error writing: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        dirty_mapped_pages.erase(page_num);
+        return;
+    }
+
+    lock_guard<mutex> lock(latch);
+    auto it = page_table.find(page_num);
+    if(it == page_table.end())
+    {
+        cout << "Tried to flush page that is not cached" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if(frames[it->second].dirty && !frames[it->second].spilled)
+    {
+        write_frame(frames[it->second]);
+    }
+}
+
+void Pager::flush_dirty_pages()
+{
+    /*
+    Write back every dirty page in page number order, merging runs of
+    neighbouring pages into one vectored write each. In mmap mode each
+    run is handed to the kernel with msync instead.
+    */
+    lock_guard<mutex> lock(latch);
+    if(backend == PAGER_MMAP)
+    {
+        auto it = dirty_mapped_pages.begin();
+        while(it != dirty_mapped_pages.end())
+        {
+            uint32_t first = *it;
+            uint32_t last = first;
+            while(++it != dirty_mapped_pages.end() && *it == last + 1)
+            {
+                last = *it;
+            }
+            IoTimer io_timer(counters);
+            if(msync(map_base + (uint64_t)first * PAGE_SIZE,
+                     (uint64_t)(last - first + 1) * PAGE_SIZE, MS_ASYNC) == -1)
+            {
+                cout << "Error writing: " << errno << endl;
+                exit(EXIT_FAILURE);
+            }
+            Counters::add(counters.pages_written, last - first + 1);
+            Counters::add(counters.pages_flushed, last - first + 1);
+            Counters::add(counters.bytes_written, (uint64_t)(last - first + 1) * PAGE_SIZE);
+        }
+        dirty_mapped_pages.clear();
+        return;
+    }
+
+    vector<Frame *> dirty;
+    for(Frame &frame : frames)
+    {
+        if(frame.page_num != INVALID_PAGE_NUM && frame.dirty && !frame.spilled)
+        {
+            dirty.push_back(&frame);
+        }
+    }
+    sort(dirty.begin(), dirty.end(), [](Frame *a, Frame *b) {
+        return a->page_num < b->page_num;
+    });
+    Counters::add(counters.pages_flushed, dirty.size());
+
+    vector<Frame *> run;
+    for(Frame *frame : dirty)
+    {
+        if(!run.empty() && (frame->page_num != run.back()->page_num + 1 || run.size() == IOV_MAX))
+        {
+            write_run(run);
+            run.clear();
+        }
+        run.push_back(frame);
+    }
+    if(!run.empty())
+    {
+        write_run(run);
+    }
+}
+
+void Pager::pager_sync()
+{
+    IoTimer io_timer(counters);
+    if(compressed != nullptr)
+    {
+        compressed->sync();
+        return;
+    }
+    if(backend == PAGER_MMAP && map_length > 0)
+    {
+        if(msync(map_base, map_length, MS_SYNC) == -1)
+        {
+            cout << "Error syncing db file: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    if(fdatasync(file_descriptor) == -1)
+    {
+        cout << "Error syncing db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Pager::spill()
+{
+    /*
+    Called between the steps of a statement that changes many pages,
+    which all stay in the pool until its commit. Once more than half
+    the pool is uncommitted, their images go to the log without a
+    commit mark and the frames may be evicted. They are dropped rather
+    than written to the database file, and read back from the log, so
+    the statement stays one commit: recovery drops spilled frames that
+    no commit mark follows.
+    */
+    lock_guard<mutex> lock(latch);
+    if(wal == nullptr || uncommitted_pages.size() <= pool_size / 2)
+    {
+        return;
+    }
+
+    sort(uncommitted_pages.begin(), uncommitted_pages.end());
+    vector<pair<uint32_t, void *>> images;
+    for(uint32_t page_num : uncommitted_pages)
+    {
+        Frame &frame = frames[page_table[page_num]];
+        images.push_back(make_pair(page_num, frame.page));
+        frame.uncommitted = false;
+        frame.spilled = true;
+        spilled_pages.insert(page_num);
+    }
+    uncommitted_pages.clear();
+    vector<uint64_t> image_offsets;
+    {
+        IoTimer io_timer(counters);
+        wal->append_spill(images, image_offsets);
+    }
+    for(size_t i = 0; i < images.size(); i++)
+    {
+        log_images[images[i].first] = image_offsets[i];
+    }
+    Counters::add(counters.pages_logged, images.size());
+    Counters::add(counters.bytes_written, images.size() * WAL_FRAME_SIZE);
+}
+
+uint64_t Pager::log_commit(bool may_checkpoint)
+{
+    /*
+    Append the images of the pages changed since the last commit to the
+    log, and return the offset wait_commit must see synced before the
+    commit is durable, 0 if there is nothing to wait for. The pages
+    stay dirty in the pool and reach the database file on eviction or
+    checkpoint, each after the log sync. Pages spilled before are part
+    of the commit, and from now on written back like the others.
+
+    With nothing new to log, the changes may have gone out with another
+    thread's commit, whose sync is waited for all the same. A checkpoint
+    empties the log under the readers' feet, so a commit made while
+    they run passes on it with may_checkpoint.
+    */
+    uint64_t commit_offset = 0;
+    {
+        lock_guard<mutex> lock(latch);
+        if(wal == nullptr)
+        {
+            return 0;
+        }
+        if(uncommitted_pages.empty() && spilled_pages.empty())
+        {
+            return wal->end_offset();
+        }
+
+        sort(uncommitted_pages.begin(), uncommitted_pages.end());
+        vector<pair<uint32_t, void *>> images;
+        for(uint32_t page_num : uncommitted_pages)
+        {
+            Frame &frame = frames[page_table[page_num]];
+            images.push_back(make_pair(page_num, frame.page));
+            frame.uncommitted = false;
+        }
+        uncommitted_pages.clear();
+        IoTimer io_timer(counters);
+        commit_offset = wal->append_commit(images, num_pages);
+        Counters::add(counters.pages_logged, images.size());
+        Counters::add(counters.bytes_written, images.size() * WAL_FRAME_SIZE);
+
+        for(uint32_t page_num : spilled_pages)
+        {
+            auto it = page_table.find(page_num);
+            if(it != page_table.end())
+            {
+                frames[it->second].spilled = false;
+            }
+        }
+        spilled_pages.clear();
+    }
+
+    if(may_checkpoint && checkpoint_due())
+    {
+        checkpoint();
+    }
+    return commit_offset;
+}
+
+bool Pager::checkpoint_due()
+{
+    return wal != nullptr && wal->frame_count() >= WAL_AUTOCHECKPOINT_FRAMES;
+}
+
+void Pager::wait_commit(uint64_t offset)
+{
+    if(offset != 0)
+    {
+        IoTimer io_timer(counters);
+        wal->sync(offset);
+    }
+}
+
+void Pager::commit()
+{
+    // Make the changes since the last commit durable
+    wait_commit(log_commit());
+}
+
+void Pager::checkpoint()
+{
+    /*
+    Move committed pages into the database file and empty the log.
+    Spilled pages that left the pool are copied over from the log.
+    */
+    commit();
+    flush_dirty_pages();
+    if(!log_images.empty())
+    {
+        lock_guard<mutex> lock(latch);
+        char page[PAGE_SIZE];
+        for(pair<const uint32_t, uint64_t> &logged : log_images)
+        {
+            IoTimer io_timer(counters);
+            wal->read_image(logged.second, page);
+            write_page_image(logged.first, page);
+        }
+        log_images.clear();
+    }
+    pager_sync();
+    if(wal != nullptr)
+    {
+        wal->reset();
+    }
+}
+
+void Pager::pager_close()
+{
+    if(wal != nullptr)
+    {
+        checkpoint();
+        wal->remove_log();
+        delete wal;
+        wal = nullptr;
+    }
+    flush_dirty_pages();
+    delete reader;   // waits for reads still in flight
+    reader = nullptr;
+    for(Frame &frame : frames)
+    {
+        if(frame.page_num != INVALID_PAGE_NUM)
+        {
+            page_table.erase(frame.page_num);
+            frame.page_num = INVALID_PAGE_NUM;
+        }
+        frame.loading = false;
+        frame.read_ahead = false;
+        free(frame.page);
+        frame.page = nullptr;
+    }
+    delete compressed;
+    compressed = nullptr;
+
+    if(backend == PAGER_MMAP)
+    {
+        munmap(map_base, MMAP_RESERVE_SIZE);
+        map_base = nullptr;
+        // Drop the unused pages the mapping was grown by
+        if(map_length > (uint64_t)num_pages * PAGE_SIZE &&
+           ftruncate(file_descriptor, (uint64_t)num_pages * PAGE_SIZE) == -1)
+        {
+            cout << "Error truncating db file: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int result = close(file_descriptor);
+    if(result == -1)
+    {
+        cout << "Error closing db file." << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void indent(uint32_t level)
+{
+    for(uint32_t i = 0; i < level; i++)
+    {
+        cout << "  ";
+    }
+}
+
+void Pager::print_tree(uint32_t page_num, uint32_t indentation_level)
+{
+    Node *node = new Node(get_page(page_num));
+    uint32_t num_keys, child;
+
+    switch (node->get_node_type())
+    {
+        case (NODE_LEAF):
+            num_keys = *((LeafNode *)node)->leaf_node_num_cells();
+            indent(indentation_level);
+            cout << "- leaf (size " << num_keys << ")" << endl;
+            for(uint32_t i = 0; i < num_keys; i++)
+            {
+                indent(indentation_level + 1);
+                cout << "- " << *((LeafNode *)node)->leaf_node_key(i) << endl;
+            }
+            break;
+        case (NODE_INTERNAL):
+            num_keys = *((InternalNode *)node)->internal_node_num_keys();
+            indent(indentation_level);
+            cout << "- internal (size " << num_keys << ")" << endl;
+            for(uint32_t i = 0; i < num_keys; i++)
+            {
+                child = *((InternalNode *)node)->internal_node_child(i);
+                print_tree(child, indentation_level + 1);
+
+                indent(indentation_level + 1);
+                cout << "- key " << *((InternalNode *)node)->internal_node_key(i) << endl;
+            }
+            child = *((InternalNode *)node)->internal_node_right_child();
+            print_tree(child, indentation_level + 1);
+            break;
+        default:
+            // Index and schema pages are not part of the table tree
+            break;
+    }
+    unpin_page(page_num);
+    delete node;
+}
+
+uint32_t Pager::get_unused_page_num()
+{
+    return num_pages;
+}
+
+void Pager::write_new_pages(uint32_t first_page_num, void *pages, uint32_t count)
+{
+    /*
+    Append freshly built pages at the end of the file with one large
+    write, bypassing the buffer pool. Used by the bulk loader; the
+    pages are not logged, so callers sync them before publishing them.
+    */
+    if(first_page_num != num_pages)
+    {
+        cout << "Tried to append page " << first_page_num << " at page " << num_pages << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if(backend == PAGER_MMAP)
+    {
+        for(uint32_t i = 0; i < count; i++)
+        {
+            void *page = get_page(first_page_num + i);
+            memcpy(page, (char *)pages + (uint64_t)i * PAGE_SIZE, PAGE_SIZE);
+            mark_dirty(first_page_num + i);
+            unpin_page(first_page_num + i);
+        }
+        return;
+    }
+
+    if(compressed != nullptr)
+    {
+        for(uint32_t i = 0; i < count; i++)
+        {
+            write_page_image(first_page_num + i, (char *)pages + (uint64_t)i * PAGE_SIZE);
+        }
+        num_pages = first_page_num + count;
+        return;
+    }
+
+    IoTimer io_timer(counters);
+    uint64_t length = (uint64_t)count * PAGE_SIZE;
+    uint64_t written = 0;
+    while(written < length)
+    {
+        ssize_t result = pwrite(file_descriptor, (char *)pages + written, length - written,
+                                (off_t)first_page_num * PAGE_SIZE + written);
+        if(result == -1)
+        {
+            cout << "Error writing: " << errno << endl;
+            exit(EXIT_FAILURE);
+        }
+        written += result;
+    }
+    Counters::add(counters.pages_written, count);
+    Counters::add(counters.bytes_written, length);
+
+    num_pages = first_page_num + count;
+    file_length = max(file_length, (uint64_t)num_pages * PAGE_SIZE);
+}
+
+void Pager::resize_file(uint32_t page_count)
+{
+    /*
+    Set the length of the database file to the size the last recovered
+    commit recorded. Pages past it were allocated by changes that never
+    committed, such as a bulk load cut short, and go; pages it counted
+    but never wrote read as zeros. Only the size of the last commit
+    matters: pages an earlier commit cut off and a later one counted
+    again are either logged by that later commit or bulk loaded into the
+    file before it.
+    */
+    if(compressed != nullptr)
+    {
+        if(page_count < compressed->page_count())
+        {
+            compressed->truncate(page_count);
+        }
+        else if(page_count > compressed->page_count())
+        {
+            static char empty_page[PAGE_SIZE];
+            compressed->write_page(page_count - 1, empty_page);
+        }
+        return;
+    }
+    if(ftruncate(file_descriptor, (off_t)page_count * PAGE_SIZE) == -1)
+    {
+        cout << "Error truncating db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Pager::truncate(uint32_t page_count)
+{
+    /*
+    Shrink the database to its first page_count pages. The pages cut
+    off must be unreferenced and checkpointed, so their frames are
+    clean and can simply be dropped. The mmap backend keeps the file
+    as long as the mapping, with the tail zeroed, and cuts it on close.
+    */
+    if(page_count >= num_pages)
+    {
+        return;
+    }
+    unique_lock<mutex> lock(latch);
+    for(uint32_t frame_num = 0; frame_num < frames.size(); frame_num++)
+    {
+        Frame &frame = frames[frame_num];
+        if(frame.page_num != INVALID_PAGE_NUM && frame.page_num >= page_count)
+        {
+            if(frame.loading)
+            {
+                frame.pin_count++;
+                wait_for_read(lock, frame_num);
+                frame.pin_count--;
+            }
+            if(frame.pin_count > 0 || frame.dirty)
+            {
+                cout << "Tried to truncate page " << frame.page_num << " that is in use" << endl;
+                exit(EXIT_FAILURE);
+            }
+            page_table.erase(frame.page_num);
+            frame.page_num = INVALID_PAGE_NUM;
+            frame.referenced = false;
+        }
+    }
+    num_pages = page_count;
+
+    if(compressed != nullptr)
+    {
+        compressed->truncate(page_count);
+        return;
+    }
+    file_length = min(file_length, (uint64_t)page_count * PAGE_SIZE);
+    if(ftruncate(file_descriptor, (uint64_t)page_count * PAGE_SIZE) == -1 ||
+       (backend == PAGER_MMAP && ftruncate(file_descriptor, map_length) == -1))
+    {
+        cout << "Error truncating db file: " << errno << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+#define NODE_MIN_FILL_PERCENT 30   // a non-root node below this merges with or borrows from a neighbour
+
+class Table;
+class Cursor
+{
+private:
+    Table *table;
+    uint32_t page_num;
+    void *page; // pinned and latched for the lifetime of the cursor
+    bool for_change; // the leaf is latched exclusively, not shared
+    uint32_t cell_num;
+    bool end_of_table;
+    vector<uint32_t> parents; // internal pages from the root down to the leaf's parent
+
+    // Read-ahead for scans: the leaves after this one, and how many of
+    // them were requested
+    deque<uint32_t> upcoming_leaves;
+    uint32_t requested_leaves;
+
+    void read_ahead();
+
+public:
+    Cursor(Table *table);
+    Cursor(Table *table, uint32_t page_num, uint32_t key, bool for_change = false);
+    ~Cursor();
+    void *cursor_value();
+    uint32_t cursor_key();
+    void cursor_advance();
+    bool leaf_node_insert(uint32_t key, Row &value);
+    void leaf_node_split_and_insert(uint32_t key, Row &value);
+
+    friend class Table;
+    friend class DB;
+};
+
+class Table
+{
+private:
+    uint32_t root_page_num;
+    Pager pager;
+    uint32_t schema_page_num;
+    uint32_t index_root_page_nums[INDEX_COLUMN_COUNT];   // 0 for no index
+    uint32_t free_page_num;                              // head of the free list, 0 if empty
+
+    // Held shared by lookups and scans and exclusively by changes,
+    // except for the inserts that fit their leaf, see insert_row_shared
+    shared_mutex latch;
+
+    /*
+    One latch per page, for the work done with the table latch shared.
+    A descent latches each child shared before letting go of its
+    parent, and an insert takes its leaf exclusively. Grown on demand
+    under page_latches_latch; a deque never moves its elements.
+    */
+    deque<shared_mutex> page_latches;
+    mutex page_latches_latch;
+
+    // Held shared by an insert beside others for the whole of its
+    // change, and exclusively by what must see none half done: a
+    // commit logging the pages, and reads of the subtree counts
+    shared_mutex in_place_latch;
+
+    uint64_t log_commit(bool may_checkpoint);
+public:
+    Table(const char *filename, uint32_t pool_size, PagerBackend backend, bool compress)
+        : pager(filename, pool_size, backend, compress)
+    {
+        root_page_num = 0;
+        if(pager.num_pages == 0)
+        {
+            // New file. Initialize page 0 as leaf node.
+            LeafNode root_node = pager.get_page(0);
+            root_node.initialize_leaf_node();
+            root_node.set_node_root(true);
+            pager.mark_dirty(0);
+            pager.unpin_page(0);
+            schema_page_num = 0;
+            schema_page();
+            pager.commit();
+        }
+
+        Node root_node = pager.get_page(root_page_num);
+        schema_page_num = *root_node.node_parent();
+        pager.unpin_page(root_page_num);
+
+        // A file of another format has no schema page where the root
+        // points, or not one of this format
+        uint32_t format[2] = {0, 0};
+        if(schema_page_num != 0 && schema_page_num < pager.num_pages)
+        {
+            Node schema = pager.get_page(schema_page_num);
+            if(schema.get_node_type() == NODE_SCHEMA)
+            {
+                memcpy(format, (char *)schema.get_node() + SCHEMA_FORMAT_MAGIC_OFFSET, sizeof(format));
+            }
+            pager.unpin_page(schema_page_num);
+        }
+        if(format[0] != DB_FORMAT_MAGIC)
+        {
+            cout << "Unsupported database format. Import the data again." << endl;
+            exit(EXIT_FAILURE);
+        }
+        if(format[1] != DB_FORMAT_VERSION)
+        {
+            cout << "Unsupported database format version " << format[1] << ", expected "
+                 << DB_FORMAT_VERSION << ". Import the data again." << endl;
+            exit(EXIT_FAILURE);
+        }
+        Node schema = pager.get_page(schema_page_num);
+        memcpy(index_root_page_nums, (char *)schema.get_node() + SCHEMA_INDEX_ROOTS_OFFSET,
+               sizeof(index_root_page_nums));
+        memcpy(&free_page_num, (char *)schema.get_node() + SCHEMA_FREE_PAGE_OFFSET, sizeof(free_page_num));
+        pager.unpin_page(schema_page_num);
+    }
+    shared_mutex &page_latch(uint32_t page_num);
+    Cursor *table_find(uint32_t key, bool for_change = false);
+    Cursor *table_seek(uint32_t key);
+    void create_new_root(uint32_t right_child_page_num);
+    Cursor *internal_node_find(uint32_t page_num, uint32_t key, bool for_change);
+    uint32_t get_node_max_key(uint32_t page_num);
+    void update_internal_node_key(uint32_t page_num, uint32_t old_key, uint32_t new_key);
+    void internal_node_insert(vector<uint32_t> &parents, uint32_t child_page_num);
+    void internal_node_split_and_insert(vector<uint32_t> &parents, uint32_t child_page_num);
+    uint32_t node_row_count(uint32_t page_num);
+    void recount_child(InternalNode &parent, uint32_t child_num);
+    void add_to_path_counts(vector<uint32_t> &parents, uint32_t key, int32_t delta);
+    void recount_path(uint32_t key);
+    uint64_t count_rows_below(uint32_t key);
+    void tree_stats(Stats &stats);
+    void leaves_from(uint32_t key, uint32_t depth, deque<uint32_t> &leaves);
+    Cursor *table_seek_position(uint64_t position);
+    bool is_empty();
+    ExecuteResult insert_row(Row &row);
+    bool insert_row_shared(Row &row, ExecuteResult &result);
+    ExecuteResult insert_rows(vector<Row> &rows);
+    bool find_row(uint32_t key, function<void(const RowView &)> callback);
+    bool delete_row(uint32_t key);
+    uint32_t delete_rows(uint32_t low, uint32_t high);
+    ExecuteResult update_row(Row &row);
+    bool is_underfull(uint32_t page_num);
+    bool merge_nodes(uint32_t left_page_num, uint32_t right_page_num, uint32_t separator);
+    uint32_t redistribute_nodes(uint32_t left_page_num, uint32_t right_page_num, uint32_t separator);
+    void rebalance(vector<uint32_t> &parents, uint32_t page_num);
+    uint32_t schema_page();
+    uint32_t allocate_page();
+    void free_page(uint32_t page_num);
+    void visit_page_refs(uint32_t page_num, function<void(uint32_t &)> visit);
+    uint32_t vacuum();
+    void commit(unique_lock<shared_mutex> &lock);
+    void commit(shared_lock<shared_mutex> &lock);
+    void scan_rows(uint32_t low, uint32_t high, function<bool(const RowView &)> callback, uint32_t offset = 0);
+    uint32_t bulk_load(function<bool(Row &)> next_row, uint32_t fill_percent);
+
+    uint32_t index_find_leaf(uint32_t page_num, const char *entry, vector<uint32_t> &parents);
+    void index_insert(IndexColumn column, string_view value, uint32_t id);
+    void index_store_cells(uint32_t page_num, vector<uint32_t> &parents, vector<IndexCell> &cells,
+                           uint32_t link);
+    void index_remove(IndexColumn column, string_view value, uint32_t id);
+    void index_rebalance(uint32_t root_page_num, vector<uint32_t> &parents, uint32_t page_num);
+    void index_free(uint32_t root_page_num);
+    void index_row(Row &row);
+    void unindex_row(Row &row);
+    void index_fill(IndexColumn column);
+    ExecuteResult create_index(IndexColumn column);
+    void find_rows_by(IndexColumn column, const string &value, bool prefix,
+                      function<bool(const RowView &)> callback);
+    vector<pair<uint32_t, uint32_t>> split_key_range(uint32_t low, uint32_t high, uint32_t num_parts);
+    void parallel_scan(uint32_t low, uint32_t high, uint32_t num_workers,
+                       function<void(uint32_t, const RowView &)> visit);
+    bool aggregate_rows(Statement &statement, uint64_t &value);
+    ~Table();
+
+    friend class Cursor;
+    friend class Database;
+};
+
+Cursor::Cursor(Table *table)
+{
+    Cursor *cursor = table->table_find(0);
+    this->table = table;
+    this->page_num = cursor->page_num;
+    this->cell_num = cursor->cell_num;
+    delete cursor;
+    this->for_change = false;
+    table->page_latch(page_num).lock_shared();
+    this->page = table->pager.get_page(page_num);
+    this->requested_leaves = 0;
+
+    LeafNode root_node = page;
+    uint32_t num_cells = *root_node.leaf_node_num_cells();
+
+    this->end_of_table = (num_cells == 0);
+}
+
+Cursor::Cursor(Table *table, uint32_t page_num, uint32_t key, bool for_change)
+{
+    this->table = table;
+    this->page_num = page_num;
+    this->for_change = for_change;
+    if(for_change)
+    {
+        table->page_latch(page_num).lock();
+    }
+    else
+    {
+        table->page_latch(page_num).lock_shared();
+    }
+    this->page = table->pager.get_page(page_num);
+    this->end_of_table = false;
+    this->requested_leaves = 0;
+
+    LeafNode root_node = page;
+    this->cell_num = root_node.leaf_node_find_cell(key);
+}
+
+Cursor::~Cursor()
+{
+    table->pager.unpin_page(page_num);
+    if(for_change)
+    {
+        table->page_latch(page_num).unlock();
+    }
+    else
+    {
+        table->page_latch(page_num).unlock_shared();
+    }
+}
+
+void *Cursor::cursor_value()
+{
+    return LeafNode(page).leaf_node_value(cell_num);
+}
+
+uint32_t Cursor::cursor_key()
+{
+    return *LeafNode(page).leaf_node_key(cell_num);
+}
+
+void Cursor::cursor_advance()
+{
+    LeafNode leaf_node = page;
+    cell_num += 1;
+    if(cell_num >= *leaf_node.leaf_node_num_cells())
+    {
+        // advance to next leaf node
+        uint32_t next_page_num = *leaf_node.leaf_node_next_leaf();
+        if(next_page_num == 0)
+        {
+            // this was right most leaf
+            end_of_table = true;
+        }
+        else
+        {
+            // One leaf latched at a time; the chain only changes with
+            // the table held exclusively
+            table->pager.unpin_page(page_num);
+            table->page_latch(page_num).unlock_shared();
+            page_num = next_page_num;
+            table->page_latch(page_num).lock_shared();
+            page = table->pager.get_page(page_num);
+            cell_num = 0;
+            read_ahead();
+        }
+    }
+}
+
+void Cursor::read_ahead()
+{
+    /*
+    Called when a scan moves on to the next leaf. The leaf chain only
+    names one leaf ahead, but the parent lists all of its children, so
+    the next READ_AHEAD_PAGES of those are kept requested. Past the
+    last child of a parent, a descent just beyond this leaf's largest
+    key finds the next parent's children.
+    */
+    LeafNode leaf = page;
+    if(parents.empty() || *leaf.leaf_node_num_cells() == 0)
+    {
+        return;
+    }
+    if(!upcoming_leaves.empty() && upcoming_leaves.front() == page_num)
+    {
+        upcoming_leaves.pop_front();
+        requested_leaves = requested_leaves > 0 ? requested_leaves - 1 : 0;
+    }
+    else
+    {
+        // The first move, or the scan left the expected leaves
+        upcoming_leaves.clear();
+        requested_leaves = 0;
+        table->leaves_from(cursor_key(), parents.size(), upcoming_leaves);
+    }
+    uint32_t max_key = leaf.get_node_max_key();
+    if(upcoming_leaves.empty() && *leaf.leaf_node_next_leaf() != 0 && max_key < UINT32_MAX)
+    {
+        table->leaves_from(max_key + 1, parents.size(), upcoming_leaves);
+    }
+    // A fresh lookup starts with this leaf, and a stale parent key can
+    // lead back to it
+    if(!upcoming_leaves.empty() && upcoming_leaves.front() == page_num)
+    {
+        upcoming_leaves.pop_front();
+    }
+
+    while(requested_leaves < upcoming_leaves.size() && requested_leaves < READ_AHEAD_PAGES)
+    {
+        table->pager.prefetch(upcoming_leaves[requested_leaves++]);
+    }
+}
+
+bool Cursor::leaf_node_insert(uint32_t key, Row &value)
+{
+    // Returns false if the leaf had to split
+    LeafNode leaf_node = page;
+    char row[ROW_MAX_SIZE];
+    uint32_t row_size = serialize_row(value, row);
+
+    if(!leaf_node.leaf_node_insert_cell(cell_num, key, row, row_size))
+    {
+        // Node full
+        leaf_node_split_and_insert(key, value);
+        return false;
+    }
+
+    table->pager.mark_dirty(page_num);
+    return true;
+}
+
+void Cursor::leaf_node_split_and_insert(uint32_t key, Row &value)
+{
+    /* 
+    Create a new node and move half the cells over,
+    Insert the new value in one of the two nodes.
+    Update parent or create a new parent.
+    */
+
+    LeafNode old_node = page;
+    uint32_t old_max = old_node.get_node_max_key();
+    bool is_root = old_node.is_node_root();
+    Counters::add(table->pager.counters.leaf_splits);
+    uint32_t new_page_num = table->allocate_page();
+    LeafNode new_node = table->pager.get_page(new_page_num);
+    table->pager.mark_dirty(page_num);
+    table->pager.mark_dirty(new_page_num);
+
+    char row[ROW_MAX_SIZE];
+    uint32_t row_size = serialize_row(value, row);
+
+    // Work from a copy of the full page, then rebuild both halves
+    char original_page[PAGE_SIZE];
+    memcpy(original_page, page, PAGE_SIZE);
+    LeafNode original = original_page;
+    uint32_t num_cells = *original.leaf_node_num_cells() + 1;
+
+    auto cell_key = [&](uint32_t i) {
+        return i == cell_num ? key : *original.leaf_node_key(i < cell_num ? i : i - 1);
+    };
+    auto cell_value = [&](uint32_t i) {
+        return i == cell_num ? (void *)row : original.leaf_node_value(i < cell_num ? i : i - 1);
+    };
+    auto cell_size = [&](uint32_t i) {
+        return i == cell_num ? row_size : (uint32_t)*original.leaf_node_value_size(i < cell_num ? i : i - 1);
+    };
+
+    /*
+    All existing cells plus the new one are divided between old(left)
+    and new(right) nodes so each gets about half of the bytes.
+    */
+    uint32_t total_bytes = 0;
+    for(uint32_t i = 0; i < num_cells; i++)
+    {
+        total_bytes += LEAF_NODE_SLOT_SIZE + cell_size(i);
+    }
+    uint32_t left_count = 0;
+    uint32_t left_bytes = 0;
+    while(left_count < num_cells - 1 &&
+          left_bytes + LEAF_NODE_SLOT_SIZE + cell_size(left_count) <= total_bytes / 2)
+    {
+        left_bytes += LEAF_NODE_SLOT_SIZE + cell_size(left_count);
+        left_count++;
+    }
+    if(left_count == 0)
+    {
+        left_count = 1;
+    }
+
+    old_node.initialize_leaf_node();
+    old_node.set_node_root(is_root);
+    new_node.initialize_leaf_node();
+    *new_node.leaf_node_next_leaf() = *original.leaf_node_next_leaf();
+    *old_node.leaf_node_next_leaf() = new_page_num;
+
+    for(uint32_t i = 0; i < num_cells; i++)
+    {
+        LeafNode destination_node = i < left_count ? old_node : new_node;
+        destination_node.leaf_node_insert_cell(*destination_node.leaf_node_num_cells(),
+                                               cell_key(i), cell_value(i), cell_size(i));
+    }
+
+    uint32_t new_max = old_node.get_node_max_key();
+    table->pager.unpin_page(new_page_num);
+
+    if(is_root)
+    {
+        table->create_new_root(new_page_num);
+    }
+    else
+    {
+        vector<uint32_t> path = parents;
+        table->update_internal_node_key(path.back(), old_max, new_max);
+        table->internal_node_insert(path, new_page_num);
+    }
+
+}
+
+shared_mutex &Table::page_latch(uint32_t page_num)
+{
+    lock_guard<mutex> lock(page_latches_latch);
+    while(page_latches.size() <= page_num)
+    {
+        page_latches.emplace_back();
+    }
+    return page_latches[page_num];
+}
+
+Cursor *Table::table_find(uint32_t key, bool for_change)
+{
+    /*
+    A node's type only changes with the table held exclusively, so it
+    is safe to read before latching the node. The leaf is latched
+    exclusively for_change.
+    */
+    LeafNode root_node = pager.get_page(root_page_num);
+    NodeType root_type = root_node.get_node_type();
+    pager.unpin_page(root_page_num);
+
+    if(root_type == NODE_LEAF)
+    {
+        return new Cursor(this, root_page_num, key, for_change);
+    }
+    else
+    {
+        page_latch(root_page_num).lock_shared();
+        return internal_node_find(root_page_num, key, for_change);
+    }
+}
+
+Cursor *Table::table_seek(uint32_t key)
+{
+    /*
+    Position a cursor on the first key >= key. table_find may stop one
+    past the last cell of a leaf, in which case the cursor moves on to
+    the start of the next leaf.
+    */
+    Cursor *cursor = table_find(key);
+    uint32_t num_cells = *LeafNode(cursor->page).leaf_node_num_cells();
+    if(num_cells == 0)
+    {
+        cursor->end_of_table = true;
+    }
+    else if(cursor->cell_num >= num_cells)
+    {
+        cursor->cell_num = num_cells - 1;
+        cursor->cursor_advance();
+    }
+    return cursor;
+}
+
+uint64_t Table::count_rows_below(uint32_t key)
+{
+    // The number of rows with keys < key: descend to key's leaf, adding
+    // up the counts of the children passed over on the way. The caller
+    // holds in_place_latch, so that no insert is half counted
+    uint64_t count = 0;
+    uint32_t page_num = root_page_num;
+    while(true)
+    {
+        Node node = pager.get_page(page_num);
+        if(node.get_node_type() == NODE_LEAF)
+        {
+            count += LeafNode(node.get_node()).leaf_node_find_cell(key);
+            pager.unpin_page(page_num);
+            return count;
+        }
+        InternalNode internal = node.get_node();
+        uint32_t child_index = internal.internal_node_find_child(key);
+        for(uint32_t i = 0; i < child_index; i++)
+        {
+            count += internal.internal_node_counts()[i];
+        }
+        uint32_t child_page_num = *internal.internal_node_child(child_index);
+        pager.unpin_page(page_num);
+        page_num = child_page_num;
+    }
+}
+
+void Table::tree_stats(Stats &stats)
+{
+    /*
+    Fill in the shape of the tree in one pass, level by level: the
+    internal levels give the height and the page numbers of the leaves,
+    which are then read, ahead of use, for their fill.
+    */
+    vector<uint32_t> level(1, root_page_num);
+    stats.tree_height = 1;
+    while(true)
+    {
+        Node first = pager.get_page(level[0]);
+        bool leaves = first.get_node_type() == NODE_LEAF;
+        pager.unpin_page(level[0]);
+        if(leaves)
+        {
+            break;
+        }
+        vector<uint32_t> children;
+        for(uint32_t page_num : level)
+        {
+            InternalNode node = pager.get_page(page_num);
+            uint32_t num_keys = *node.internal_node_num_keys();
+            for(uint32_t i = 0; i <= num_keys; i++)
+            {
+                children.push_back(*node.internal_node_child(i));
+            }
+            pager.unpin_page(page_num);
+        }
+        level.swap(children);
+        stats.tree_height++;
+    }
+
+    uint64_t used_space = 0;
+    stats.row_count = 0;
+    for(uint32_t i = 0; i < level.size(); i++)
+    {
+        if(i + READ_AHEAD_PAGES < level.size())
+        {
+            pager.prefetch(level[i + READ_AHEAD_PAGES]);
+        }
+        shared_lock<shared_mutex> leaf_latch(page_latch(level[i]));
+        LeafNode leaf = pager.get_page(level[i]);
+        used_space += leaf.leaf_node_used_space();
+        stats.row_count += *leaf.leaf_node_num_cells();
+        pager.unpin_page(level[i]);
+    }
+    stats.leaf_count = level.size();
+    stats.leaf_fill_percent = 100.0 * used_space / ((uint64_t)level.size() * LEAF_NODE_SPACE_FOR_CELLS);
+    stats.page_count = pager.num_pages;
+}
+
+void Table::leaves_from(uint32_t key, uint32_t depth, deque<uint32_t> &leaves)
+{
+    // Append the leaf where key belongs and the ones after it under the
+    // same parent, in a tree with depth internal levels. Only internal
+    // pages are read
+    uint32_t page_num = root_page_num;
+    for(uint32_t level = 1; level < depth; level++)
+    {
+        InternalNode node = pager.get_page(page_num);
+        uint32_t child_page_num = *node.internal_node_child(node.internal_node_find_child(key));
+        pager.unpin_page(page_num);
+        page_num = child_page_num;
+    }
+    InternalNode parent = pager.get_page(page_num);
+    uint32_t num_keys = *parent.internal_node_num_keys();
+    for(uint32_t i = parent.internal_node_find_child(key); i <= num_keys; i++)
+    {
+        leaves.push_back(*parent.internal_node_child(i));
+    }
+    pager.unpin_page(page_num);
+}
+
+Cursor *Table::table_seek_position(uint64_t position)
+{
+    // Position a cursor on the row with position rows before it, or at
+    // the end of the table if there are not that many. The caller holds
+    // in_place_latch, as for count_rows_below
+    uint32_t page_num = root_page_num;
+    while(true)
+    {
+        Node node = pager.get_page(page_num);
+        if(node.get_node_type() == NODE_LEAF)
+        {
+            pager.unpin_page(page_num);
+            break;
+        }
+        InternalNode internal = node.get_node();
+        uint32_t num_keys = *internal.internal_node_num_keys();
+        uint32_t child_index = 0;
+        while(child_index < num_keys && position >= *internal.internal_node_count(child_index))
+        {
+            position -= *internal.internal_node_count(child_index);
+            child_index++;
+        }
+        uint32_t child_page_num = *internal.internal_node_child(child_index);
+        pager.unpin_page(page_num);
+        page_num = child_page_num;
+    }
+
+    Cursor *cursor = new Cursor(this, page_num, 0);
+    uint32_t num_cells = *LeafNode(cursor->page).leaf_node_num_cells();
+    if(position >= num_cells)
+    {
+        cursor->end_of_table = true;
+    }
+    else
+    {
+        cursor->cell_num = position;
+    }
+    return cursor;
+}
+
+void Table::create_new_root(uint32_t right_child_page_num)
+{
+    /*
+    Handle splitting the root.
+    Old root copied to new page, becomes left child.
+    Address of right child passed in. The root may be a leaf or an
+    internal node, so the tree grows by one level each time.
+    Re-initialize root page to contain the new root node.
+    New root node points to two children.
+    */
+
+   Counters::add(pager.counters.root_splits);
+   InternalNode root = pager.get_page(root_page_num);
+   Node right_child = pager.get_page(right_child_page_num);
+   uint32_t left_child_page_num = allocate_page();
+   Node left_child = pager.get_page(left_child_page_num);
+   pager.mark_dirty(root_page_num);
+   pager.mark_dirty(left_child_page_num);
+
+   // Left child has data copied from old root
+   memcpy(left_child.get_node(), root.get_node(), PAGE_SIZE);
+   left_child.set_node_root(false);
+   uint32_t left_child_max_key = get_node_max_key(left_child_page_num);
+
+   // Root node is a new internal node with one key and two children
+   root.initialize_internal_node();
+   root.set_node_root(true);
+   *root.internal_node_num_keys() = 1;
+   *root.internal_node_child(0) = left_child_page_num;
+   *root.internal_node_key(0) = left_child_max_key;
+   *root.internal_node_right_child() = right_child_page_num;
+   recount_child(root, 0);
+   recount_child(root, 1);
+
+   pager.unpin_page(left_child_page_num);
+   pager.unpin_page(right_child_page_num);
+   pager.unpin_page(root_page_num);
+}
+
+Cursor *Table::internal_node_find(uint32_t page_num, uint32_t key, bool for_change)
+{
+    // Descend from page_num, latched shared by the caller, to the leaf
+    // which should contain key, latching each page before letting go
+    // of its parent
+    vector<uint32_t> parents;
+    uint32_t child_num;
+    while(true)
+    {
+        InternalNode node = pager.get_page(page_num);
+        uint32_t child_index = node.internal_node_find_child(key);
+        child_num = *node.internal_node_child(child_index);
+        pager.unpin_page(page_num);
+        parents.push_back(page_num);
+
+        Node child = pager.get_page(child_num);
+        NodeType child_type = child.get_node_type();
+        pager.unpin_page(child_num);
+
+        if(child_type == NODE_LEAF)
+        {
+            break;
+        }
+        page_latch(child_num).lock_shared();
+        page_latch(page_num).unlock_shared();
+        page_num = child_num;
+    }
+
+    Cursor *cursor = new Cursor(this, child_num, key, for_change);
+    page_latch(page_num).unlock_shared();
+    cursor->parents = parents;
+    return cursor;
+}
+
+uint32_t Table::get_node_max_key(uint32_t page_num)
+{
+    /*
+    The largest key of a subtree lives in its right-most leaf. Internal
+    nodes only store keys for their left children, so follow the right
+    child pointers down.
+    */
+    while(true)
+    {
+        Node node = pager.get_page(page_num);
+        if(node.get_node_type() == NODE_LEAF)
+        {
+            uint32_t max_key = LeafNode(node.get_node()).get_node_max_key();
+            pager.unpin_page(page_num);
+            return max_key;
+        }
+        uint32_t right_child = *InternalNode(node.get_node()).internal_node_right_child();
+        pager.unpin_page(page_num);
+        page_num = right_child;
+    }
+}
+
+void Table::update_internal_node_key(uint32_t page_num, uint32_t old_key, uint32_t new_key)
+{
+    InternalNode node = pager.get_page(page_num);
+    uint32_t old_child_index = node.internal_node_find_child(old_key);
+    // The right child has no key of its own
+    if(old_child_index < *node.internal_node_num_keys())
+    {
+        *node.internal_node_key(old_child_index) = new_key;
+        pager.mark_dirty(page_num);
+    }
+    pager.unpin_page(page_num);
+}
+
+uint32_t Table::node_row_count(uint32_t page_num)
+{
+    Node node = pager.get_page(page_num);
+    uint32_t count = node.get_node_type() == NODE_LEAF ? *LeafNode(node.get_node()).leaf_node_num_cells()
+                                                       : InternalNode(node.get_node()).internal_node_total_count();
+    pager.unpin_page(page_num);
+    return count;
+}
+
+void Table::recount_child(InternalNode &parent, uint32_t child_num)
+{
+    // Set a child's row count from the child itself; the caller marks
+    // the parent dirty
+    *parent.internal_node_count(child_num) = node_row_count(*parent.internal_node_child(child_num));
+}
+
+void Table::add_to_path_counts(vector<uint32_t> &parents, uint32_t key, int32_t delta)
+{
+    // Adjust the count of the child leading to key in each page of the
+    // path, after rows were added to or removed from a leaf in place.
+    // One page is latched at a time, after the leaf was let go
+    for(uint32_t page_num : parents)
+    {
+        unique_lock<shared_mutex> node_latch(page_latch(page_num));
+        InternalNode node = pager.get_page(page_num);
+        *node.internal_node_count(node.internal_node_find_child(key)) += delta;
+        pager.mark_dirty(page_num);
+        pager.unpin_page(page_num);
+    }
+}
+
+void Table::recount_path(uint32_t key)
+{
+    /*
+    Recount the children on the path to key from the bottom up, after
+    a leaf split. The split recounted the pages it touched, but the
+    ones above still miss the rows that were added.
+    */
+    Cursor *cursor = table_find(key);
+    vector<uint32_t> parents = cursor->parents;
+    delete cursor;
+    for(uint32_t i = parents.size(); i-- > 0;)
+    {
+        InternalNode node = pager.get_page(parents[i]);
+        recount_child(node, node.internal_node_find_child(key));
+        pager.mark_dirty(parents[i]);
+        pager.unpin_page(parents[i]);
+    }
+}
+
+void Table::internal_node_insert(vector<uint32_t> &parents, uint32_t child_page_num)
+{
+    /*
+    Add a new child/key pair to the parent at the end of the path,
+    splitting it if it is full.
+    */
+    uint32_t parent_page_num = parents.back();
+    InternalNode parent = pager.get_page(parent_page_num);
+    uint32_t original_num_keys = *parent.internal_node_num_keys();
+
+    if(original_num_keys >= INTERNAL_NODE_MAX_KEYS)
+    {
+        pager.unpin_page(parent_page_num);
+        internal_node_split_and_insert(parents, child_page_num);
+        return;
+    }
+
+    pager.mark_dirty(parent_page_num);
+    uint32_t child_max_key = get_node_max_key(child_page_num);
+    uint32_t index = parent.internal_node_find_child(child_max_key);
+    uint32_t right_child_page_num = *parent.internal_node_right_child();
+    uint32_t right_child_max_key = get_node_max_key(right_child_page_num);
+
+    *parent.internal_node_num_keys() = original_num_keys + 1;
+
+    if(child_max_key > right_child_max_key)
+    {
+        // Replace right child
+        *parent.internal_node_child(original_num_keys) = right_child_page_num;
+        *parent.internal_node_key(original_num_keys) = right_child_max_key;
+        *parent.internal_node_right_child() = child_page_num;
+        index = original_num_keys + 1;
+    }
+    else
+    {
+        // Make room for the new key and child
+        memmove(parent.internal_node_key(index + 1), parent.internal_node_key(index),
+                (original_num_keys - index) * INTERNAL_NODE_KEY_SIZE);
+        memmove(parent.internal_node_children() + index + 1, parent.internal_node_children() + index,
+                (original_num_keys - index) * INTERNAL_NODE_CHILD_SIZE);
+        memmove(parent.internal_node_counts() + index + 1, parent.internal_node_counts() + index,
+                (original_num_keys - index) * INTERNAL_NODE_COUNT_SIZE);
+        *parent.internal_node_child(index) = child_page_num;
+        *parent.internal_node_key(index) = child_max_key;
+    }
+
+    // The new child is the right half of the child before it, whose
+    // count changed
+    recount_child(parent, index);
+    if(index > 0)
+    {
+        recount_child(parent, index - 1);
+    }
+
+    pager.unpin_page(parent_page_num);
+}
+
+void Table::internal_node_split_and_insert(vector<uint32_t> &parents, uint32_t child_page_num)
+{
+    /*
+    Split a full internal node. The children, including the new one,
+    are laid out in key order, the left half stays in the old node and
+    the right half moves to a new node, which is then inserted into the
+    grandparent the same way a new leaf is inserted into its parent.
+    */
+    Counters::add(pager.counters.internal_splits);
+    uint32_t old_page_num = parents.back();
+    parents.pop_back();
+    uint32_t old_max = get_node_max_key(old_page_num);
+    uint32_t child_max_key = get_node_max_key(child_page_num);
+
+    InternalNode old_node = pager.get_page(old_page_num);
+    uint32_t num_keys = *old_node.internal_node_num_keys();
+    vector<uint32_t> children, keys, counts;
+    for(uint32_t i = 0; i < num_keys; i++)
+    {
+        children.push_back(*old_node.internal_node_child(i));
+        keys.push_back(*old_node.internal_node_key(i));
+    }
+    uint32_t right_child_page_num = *old_node.internal_node_right_child();
+    children.push_back(right_child_page_num);
+
+    uint32_t index = old_node.internal_node_find_child(child_max_key);
+    if(index == num_keys && child_max_key > get_node_max_key(right_child_page_num))
+    {
+        // New child becomes the right-most child
+        keys.push_back(get_node_max_key(right_child_page_num));
+        children.push_back(child_page_num);
+        index = num_keys + 1;
+    }
+    else
+    {
+        keys.insert(keys.begin() + index, child_max_key);
+        children.insert(children.begin() + index, child_page_num);
+    }
+
+    // Counts carry over, except for the new child and the one it was
+    // split from
+    counts.assign(old_node.internal_node_counts(), old_node.internal_node_counts() + num_keys);
+    counts.push_back(*old_node.internal_node_right_count());
+    counts.insert(counts.begin() + index, node_row_count(child_page_num));
+    if(index > 0)
+    {
+        counts[index - 1] = node_row_count(children[index - 1]);
+    }
+
+    uint32_t left_count = children.size() / 2;
+    uint32_t new_page_num = allocate_page();
+    InternalNode new_node = pager.get_page(new_page_num);
+    new_node.initialize_internal_node();
+    pager.mark_dirty(old_page_num);
+    pager.mark_dirty(new_page_num);
+
+    *old_node.internal_node_num_keys() = left_count - 1;
+    for(uint32_t i = 0; i < left_count; i++)
+    {
+        *old_node.internal_node_child(i) = children[i];
+        *old_node.internal_node_count(i) = counts[i];
+        if(i < left_count - 1)
+        {
+            *old_node.internal_node_key(i) = keys[i];
+        }
+    }
+    uint32_t new_old_max = keys[left_count - 1];
+
+    uint32_t right_count = children.size() - left_count;
+    *new_node.internal_node_num_keys() = right_count - 1;
+    for(uint32_t i = 0; i < right_count; i++)
+    {
+        *new_node.internal_node_child(i) = children[left_count + i];
+        *new_node.internal_node_count(i) = counts[left_count + i];
+        if(i < right_count - 1)
+        {
+            *new_node.internal_node_key(i) = keys[left_count + i];
+        }
+    }
+
+    bool splitting_root = old_node.is_node_root();
+    pager.unpin_page(new_page_num);
+    pager.unpin_page(old_page_num);
+
+    if(splitting_root)
+    {
+        create_new_root(new_page_num);
+    }
+    else
+    {
+        update_internal_node_key(parents.back(), old_max, new_old_max);
+        internal_node_insert(parents, new_page_num);
+    }
+}
+
+bool Table::is_empty()
+{
+    shared_lock<shared_mutex> root_latch(page_latch(root_page_num));
+    LeafNode root_node = pager.get_page(root_page_num);
+    bool empty = root_node.get_node_type() == NODE_LEAF && *root_node.leaf_node_num_cells() == 0;
+    pager.unpin_page(root_page_num);
+    return empty;
+}
+
+ExecuteResult Table::insert_row(Row &row)
+{
+    Cursor *cursor = table_find(row.id);
+
+    LeafNode leaf_node = cursor->page;
+    uint32_t num_cells = *leaf_node.leaf_node_num_cells();
+
+    if(cursor->cell_num < num_cells)
+    {
+        uint32_t key_at_index = *leaf_node.leaf_node_key(cursor->cell_num);
+        if(key_at_index == row.id)
+        {
+            delete cursor;
+            return EXECUTE_DUPLICATE_KEY;
+        }
+    }
+
+    if(cursor->leaf_node_insert(row.id, row))
+    {
+        vector<uint32_t> parents = cursor->parents;
+        delete cursor;
+        add_to_path_counts(parents, row.id, 1);
+    }
+    else
+    {
+        delete cursor;
+        recount_path(row.id);
+    }
+
+    index_row(row);
+    return EXECUTE_SUCCESS;
+}
+
+bool Table::insert_row_shared(Row &row, ExecuteResult &result)
+{
+    /*
+    insert_row for a caller holding the table latch shared, so that
+    inserts run beside lookups, scans and each other. The descent
+    latches the leaf exclusively, which the row changes alone if it
+    fits; the path counts are then raised a page at a time, with the
+    leaf let go. Returns false, having changed nothing, if the insert
+    needs the table to itself: for a leaf split, for index maintenance,
+    or to run the checkpoint that is due.
+    */
+    if(index_root_page_nums[INDEX_USERNAME] != 0 || index_root_page_nums[INDEX_EMAIL] != 0 ||
+       pager.checkpoint_due())
+    {
+        return false;
+    }
+
+    shared_lock<shared_mutex> in_place(in_place_latch);
+    Cursor *cursor = table_find(row.id, true);
+    LeafNode leaf_node = cursor->page;
+    if(cursor->cell_num < *leaf_node.leaf_node_num_cells() && cursor->cursor_key() == row.id)
+    {
+        delete cursor;
+        result = EXECUTE_DUPLICATE_KEY;
+        return true;
+    }
+
+    char value[ROW_MAX_SIZE];
+    uint32_t row_size = serialize_row(row, value);
+    if(!leaf_node.leaf_node_insert_cell(cursor->cell_num, row.id, value, row_size))
+    {
+        delete cursor;
+        return false;
+    }
+    pager.mark_dirty(cursor->page_num);
+    vector<uint32_t> parents = cursor->parents;
+    delete cursor;
+
+    add_to_path_counts(parents, row.id, 1);
+    result = EXECUTE_SUCCESS;
+    return true;
+}
+
+ExecuteResult Table::insert_rows(vector<Row> &rows)
+{
+    /*
+    Insert a batch of rows. The batch is sorted and checked for
+    duplicate keys in one pass before anything changes, so a duplicate
+    rejects the whole batch. Then each leaf is reached with one descent
+    and receives all its rows in a single merge pass; a leaf that fills
+    up is split around the row that did not fit and the rest of the
+    batch descends again.
+    */
+    sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+        return a.id < b.id;
+    });
+    for(size_t i = 1; i < rows.size(); i++)
+    {
+        if(rows[i].id == rows[i - 1].id)
+        {
+            return EXECUTE_DUPLICATE_KEY;
+        }
+    }
+
+    // Rows up to the leaf's max key belong to it, and all remaining rows
+    // belong to the last leaf
+    auto rows_for_leaf = [&rows](LeafNode &leaf, size_t first) {
+        uint32_t num_cells = *leaf.leaf_node_num_cells();
+        if(*leaf.leaf_node_next_leaf() == 0 || num_cells == 0)
+        {
+            return rows.size();
+        }
+        uint32_t max_key = *leaf.leaf_node_key(num_cells - 1);
+        size_t end = first + 1;
+        while(end < rows.size() && rows[end].id <= max_key)
+        {
+            end++;
+        }
+        return end;
+    };
+
+    size_t i = 0;
+    while(i < rows.size())
+    {
+        Cursor *cursor = table_find(rows[i].id);
+        LeafNode leaf = cursor->page;
+        uint32_t num_cells = *leaf.leaf_node_num_cells();
+        size_t end = rows_for_leaf(leaf, i);
+        for(uint32_t cell_num = cursor->cell_num; i < end; i++)
+        {
+            while(cell_num < num_cells && *leaf.leaf_node_key(cell_num) < rows[i].id)
+            {
+                cell_num++;
+            }
+            if(cell_num < num_cells && *leaf.leaf_node_key(cell_num) == rows[i].id)
+            {
+                delete cursor;
+                return EXECUTE_DUPLICATE_KEY;
+            }
+        }
+        delete cursor;
+    }
+
+    char row[ROW_MAX_SIZE];
+    i = 0;
+    while(i < rows.size())
+    {
+        size_t first = i;
+        Cursor *cursor = table_find(rows[i].id);
+        LeafNode leaf = cursor->page;
+        size_t end = rows_for_leaf(leaf, i);
+        bool split = false;
+        pager.mark_dirty(cursor->page_num);
+        for(uint32_t cell_num = cursor->cell_num; i < end; i++, cell_num++)
+        {
+            while(cell_num < *leaf.leaf_node_num_cells() && *leaf.leaf_node_key(cell_num) < rows[i].id)
+            {
+                cell_num++;
+            }
+            uint32_t row_size = serialize_row(rows[i], row);
+            if(!leaf.leaf_node_insert_cell(cell_num, rows[i].id, row, row_size))
+            {
+                cursor->cell_num = cell_num;
+                cursor->leaf_node_split_and_insert(rows[i].id, rows[i]);
+                split = true;
+                i++;
+                break;
+            }
+        }
+        if(split)
+        {
+            delete cursor;
+            recount_path(rows[first].id);
+        }
+        else
+        {
+            vector<uint32_t> parents = cursor->parents;
+            delete cursor;
+            add_to_path_counts(parents, rows[first].id, i - first);
+        }
+
+        for(; first < i; first++)
+        {
+            index_row(rows[first]);
+        }
+
+        // Uncommitted pages cannot be evicted, so a batch touching more
+        // pages than the pool can hold spills them to the log
+        pager.spill();
+    }
+    return EXECUTE_SUCCESS;
+}
+
+bool Table::find_row(uint32_t key, function<void(const RowView &)> callback)
+{
+    // One root-to-leaf descent; the cursor lands on the key or on the
+    // cell where it would be inserted. The row is handed to callback
+    // in place, while the cursor still pins its leaf
+    Cursor *cursor = table_find(key);
+
+    bool found = cursor->cell_num < *LeafNode(cursor->page).leaf_node_num_cells() &&
+                 cursor->cursor_key() == key;
+    if(found)
+    {
+        Counters::add(pager.counters.rows_examined);
+        callback(RowView(cursor->cursor_value()));
+    }
+
+    delete cursor;
+    return found;
+}
+
+void Table::scan_rows(uint32_t low, uint32_t high, function<bool(const RowView &)> callback, uint32_t offset)
+{
+    // Seek to the first key in range, or offset rows past it by the
+    // subtree counts, then follow the leaf chain until the range ends
+    // or the callback declines more rows
+    Cursor *cursor;
+    if(offset == 0)
+    {
+        cursor = table_seek(low);
+    }
+    else
+    {
+        unique_lock<shared_mutex> counts(in_place_latch);
+        cursor = table_seek_position(count_rows_below(low) + offset);
+    }
+
+    uint64_t examined = 0;
+    while(!cursor->end_of_table && cursor->cursor_key() <= high)
+    {
+        examined++;
+        if(!callback(RowView(cursor->cursor_value())))
+        {
+            break;
+        }
+        cursor->cursor_advance();
+    }
+
+    delete cursor;
+    Counters::add(pager.counters.rows_examined, examined);
+}
+
+bool Table::delete_row(uint32_t key)
+{
+    Cursor *cursor = table_find(key);
+    LeafNode leaf = cursor->page;
+    if(cursor->cell_num >= *leaf.leaf_node_num_cells() || cursor->cursor_key() != key)
+    {
+        delete cursor;
+        return false;
+    }
+
+    Row row = RowView(cursor->cursor_value()).to_row();
+    leaf.leaf_node_remove_cell(cursor->cell_num);
+    pager.mark_dirty(cursor->page_num);
+    vector<uint32_t> parents = cursor->parents;
+    uint32_t page_num = cursor->page_num;
+    delete cursor;
+    add_to_path_counts(parents, key, -1);
+
+    unindex_row(row);
+    rebalance(parents, page_num);
+    return true;
+}
+
+uint32_t Table::delete_rows(uint32_t low, uint32_t high)
+{
+    /*
+    Delete the rows with keys in [low, high] and return how many there
+    were. Each leaf in the range loses its whole run of keys at once,
+    with one count update along its path and one rebalance, and the
+    next descent starts past the last key removed, since rebalancing
+    moves cells between leaves. Like batch inserts, a large delete
+    spills to the log and stays one commit.
+    */
+    uint32_t num_deleted = 0;
+    uint32_t key = low;
+    while(key <= high)
+    {
+        Cursor *cursor = table_find(key);
+        LeafNode leaf = cursor->page;
+        uint32_t num_cells = *leaf.leaf_node_num_cells();
+        if(cursor->cell_num >= num_cells)
+        {
+            // Past the end of this leaf: go on from the next key there is
+            delete cursor;
+            cursor = table_seek(key);
+            bool done = cursor->end_of_table || cursor->cursor_key() > high;
+            key = done ? key : cursor->cursor_key();
+            delete cursor;
+            if(done)
+            {
+                break;
+            }
+            continue;
+        }
+
+        uint32_t first_cell = cursor->cell_num;
+        uint32_t end_cell = first_cell;
+        vector<Row> rows;
+        while(end_cell < num_cells && *leaf.leaf_node_key(end_cell) <= high)
+        {
+            rows.push_back(RowView((char *)leaf.leaf_node_value(end_cell)).to_row());
+            end_cell++;
+        }
+        if(rows.empty())
+        {
+            delete cursor;
+            break;
+        }
+        for(uint32_t cell_num = end_cell; cell_num-- > first_cell;)
+        {
+            leaf.leaf_node_remove_cell(cell_num);
+        }
+        pager.mark_dirty(cursor->page_num);
+        vector<uint32_t> parents = cursor->parents;
+        uint32_t page_num = cursor->page_num;
+        delete cursor;
+        add_to_path_counts(parents, rows.front().id, -(int32_t)rows.size());
+
+        for(Row &row : rows)
+        {
+            unindex_row(row);
+        }
+        rebalance(parents, page_num);
+        pager.spill();
+        num_deleted += rows.size();
+
+        // A run cut short by a larger key ends the range
+        uint32_t last_key = rows.back().id;
+        if(end_cell < num_cells || last_key == UINT32_MAX)
+        {
+            break;
+        }
+        key = last_key + 1;
+    }
+    return num_deleted;
+}
+
+ExecuteResult Table::update_row(Row &row)
+{
+    /*
+    Replace the username and email of the row with row.id. A row that
+    does not grow is rewritten in place; a longer one is removed and
+    inserted again, which may split the leaf.
+    */
+    Cursor *cursor = table_find(row.id);
+    LeafNode leaf = cursor->page;
+    if(cursor->cell_num >= *leaf.leaf_node_num_cells() || cursor->cursor_key() != row.id)
+    {
+        delete cursor;
+        return EXECUTE_NOT_FOUND;
+    }
+
+    Row old_row = RowView(cursor->cursor_value()).to_row();
+    char serialized_row[ROW_MAX_SIZE];
+    uint32_t row_size = serialize_row(row, serialized_row);
+    bool split = false;
+    pager.mark_dirty(cursor->page_num);
+    if(row_size <= *leaf.leaf_node_value_size(cursor->cell_num))
+    {
+        memcpy(cursor->cursor_value(), serialized_row, row_size);
+        *leaf.leaf_node_value_size(cursor->cell_num) = row_size;
+    }
+    else
+    {
+        // The row count only changes if the leaf splits
+        leaf.leaf_node_remove_cell(cursor->cell_num);
+        split = !cursor->leaf_node_insert(row.id, row);
+    }
+    delete cursor;
+    if(split)
+    {
+        recount_path(row.id);
+    }
+
+    if(index_root_page_nums[INDEX_USERNAME] != 0 && strcmp(old_row.username, row.username) != 0)
+    {
+        index_remove(INDEX_USERNAME, old_row.username, row.id);
+        index_insert(INDEX_USERNAME, row.username, row.id);
+    }
+    if(index_root_page_nums[INDEX_EMAIL] != 0 && strcmp(old_row.email, row.email) != 0)
+    {
+        index_remove(INDEX_EMAIL, old_row.email, row.id);
+        index_insert(INDEX_EMAIL, row.email, row.id);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+bool Table::is_underfull(uint32_t page_num)
+{
+    Node node = pager.get_page(page_num);
+    NodeType type = node.get_node_type();
+    bool underfull;
+    if(type == NODE_LEAF || type == NODE_INDEX_LEAF || type == NODE_INDEX_INTERNAL)
+    {
+        underfull = LeafNode(node.get_node()).leaf_node_used_space()
+                    < LEAF_NODE_SPACE_FOR_CELLS * NODE_MIN_FILL_PERCENT / 100;
+    }
+    else
+    {
+        underfull = *InternalNode(node.get_node()).internal_node_num_keys() + 1
+                    < (INTERNAL_NODE_MAX_KEYS + 1) * NODE_MIN_FILL_PERCENT / 100;
+    }
+    pager.unpin_page(page_num);
+    return underfull;
+}
+
+bool Table::merge_nodes(uint32_t left_page_num, uint32_t right_page_num, uint32_t separator)
+{
+    /*
+    Move everything in the right node onto the end of its left
+    neighbour if it all fits in one page. separator is the parent's
+    key between the two. Returns false, changing nothing, otherwise.
+    The right page is no longer part of the tree afterwards.
+    */
+    Node left = pager.get_page(left_page_num);
+    Node right = pager.get_page(right_page_num);
+    bool merged = false;
+    if(left.get_node_type() == NODE_LEAF)
+    {
+        LeafNode left_leaf = left.get_node();
+        LeafNode right_leaf = right.get_node();
+        if(left_leaf.leaf_node_used_space() + right_leaf.leaf_node_used_space() <= LEAF_NODE_SPACE_FOR_CELLS)
+        {
+            for(uint32_t i = 0; i < *right_leaf.leaf_node_num_cells(); i++)
+            {
+                left_leaf.leaf_node_insert_cell(*left_leaf.leaf_node_num_cells(), *right_leaf.leaf_node_key(i),
+                                                right_leaf.leaf_node_value(i), *right_leaf.leaf_node_value_size(i));
+            }
+            *left_leaf.leaf_node_next_leaf() = *right_leaf.leaf_node_next_leaf();
+            merged = true;
+        }
+    }
+    else
+    {
+        // The left node's right child gets the separator as its key
+        InternalNode left_node = left.get_node();
+        InternalNode right_node = right.get_node();
+        uint32_t left_keys = *left_node.internal_node_num_keys();
+        uint32_t right_keys = *right_node.internal_node_num_keys();
+        if(left_keys + 1 + right_keys <= INTERNAL_NODE_MAX_KEYS)
+        {
+            *left_node.internal_node_num_keys() = left_keys + 1 + right_keys;
+            left_node.internal_node_children()[left_keys] = *left_node.internal_node_right_child();
+            left_node.internal_node_counts()[left_keys] = *left_node.internal_node_right_count();
+            left_node.internal_node_keys()[left_keys] = separator;
+            memcpy(left_node.internal_node_keys() + left_keys + 1, right_node.internal_node_keys(),
+                   right_keys * INTERNAL_NODE_KEY_SIZE);
+            memcpy(left_node.internal_node_children() + left_keys + 1, right_node.internal_node_children(),
+                   right_keys * INTERNAL_NODE_CHILD_SIZE);
+            memcpy(left_node.internal_node_counts() + left_keys + 1, right_node.internal_node_counts(),
+                   right_keys * INTERNAL_NODE_COUNT_SIZE);
+            *left_node.internal_node_right_child() = *right_node.internal_node_right_child();
+            *left_node.internal_node_right_count() = *right_node.internal_node_right_count();
+            merged = true;
+        }
+    }
+    if(merged)
+    {
+        pager.mark_dirty(left_page_num);
+    }
+    pager.unpin_page(right_page_num);
+    pager.unpin_page(left_page_num);
+    return merged;
+}
+
+uint32_t Table::redistribute_nodes(uint32_t left_page_num, uint32_t right_page_num, uint32_t separator)
+{
+    /*
+    Share the contents of two neighbours evenly, leaves by bytes and
+    internal nodes by children, keeping key order. Returns the new
+    separator, the largest key left in the left node.
+    */
+    Node left = pager.get_page(left_page_num);
+    Node right = pager.get_page(right_page_num);
+    pager.mark_dirty(left_page_num);
+    pager.mark_dirty(right_page_num);
+    uint32_t new_separator;
+    if(left.get_node_type() == NODE_LEAF)
+    {
+        char left_copy[PAGE_SIZE];
+        char right_copy[PAGE_SIZE];
+        memcpy(left_copy, left.get_node(), PAGE_SIZE);
+        memcpy(right_copy, right.get_node(), PAGE_SIZE);
+        LeafNode sources[2] = {LeafNode(left_copy), LeafNode(right_copy)};
+        uint32_t left_cells = *sources[0].leaf_node_num_cells();
+        uint32_t num_cells = left_cells + *sources[1].leaf_node_num_cells();
+        auto source = [&](uint32_t i) { return i < left_cells ? make_pair(sources[0], i) : make_pair(sources[1], i - left_cells); };
+
+        uint32_t total_bytes = sources[0].leaf_node_used_space() + sources[1].leaf_node_used_space();
+        uint32_t left_count = 0;
+        uint32_t left_bytes = 0;
+        while(left_count < num_cells - 1)
+        {
+            pair<LeafNode, uint32_t> cell = source(left_count);
+            uint32_t cell_bytes = LEAF_NODE_SLOT_SIZE + *cell.first.leaf_node_value_size(cell.second);
+            if(left_count > 0 && left_bytes + cell_bytes > total_bytes / 2)
+            {
+                break;
+            }
+            left_bytes += cell_bytes;
+            left_count++;
+        }
+
+        LeafNode left_leaf = left.get_node();
+        LeafNode right_leaf = right.get_node();
+        left_leaf.initialize_leaf_node();
+        *left_leaf.leaf_node_next_leaf() = right_page_num;
+        right_leaf.initialize_leaf_node();
+        *right_leaf.leaf_node_next_leaf() = *sources[1].leaf_node_next_leaf();
+        for(uint32_t i = 0; i < num_cells; i++)
+        {
+            pair<LeafNode, uint32_t> cell = source(i);
+            LeafNode destination = i < left_count ? left_leaf : right_leaf;
+            destination.leaf_node_insert_cell(*destination.leaf_node_num_cells(),
+                                              *cell.first.leaf_node_key(cell.second),
+                                              cell.first.leaf_node_value(cell.second),
+                                              *cell.first.leaf_node_value_size(cell.second));
+        }
+        new_separator = left_leaf.get_node_max_key();
+    }
+    else
+    {
+        InternalNode left_node = left.get_node();
+        InternalNode right_node = right.get_node();
+        vector<uint32_t> children, keys, counts;
+        for(InternalNode node : {left_node, right_node})
+        {
+            uint32_t num_keys = *node.internal_node_num_keys();
+            keys.insert(keys.end(), node.internal_node_keys(), node.internal_node_keys() + num_keys);
+            children.insert(children.end(), node.internal_node_children(), node.internal_node_children() + num_keys);
+            children.push_back(*node.internal_node_right_child());
+            counts.insert(counts.end(), node.internal_node_counts(), node.internal_node_counts() + num_keys);
+            counts.push_back(*node.internal_node_right_count());
+            if(keys.size() < children.size())
+            {
+                keys.push_back(separator);
+            }
+        }
+        keys.pop_back();
+
+        uint32_t left_count = children.size() / 2;
+        *left_node.internal_node_num_keys() = left_count - 1;
+        memcpy(left_node.internal_node_keys(), keys.data(), (left_count - 1) * INTERNAL_NODE_KEY_SIZE);
+        memcpy(left_node.internal_node_children(), children.data(), (left_count - 1) * INTERNAL_NODE_CHILD_SIZE);
+        memcpy(left_node.internal_node_counts(), counts.data(), (left_count - 1) * INTERNAL_NODE_COUNT_SIZE);
+        *left_node.internal_node_right_child() = children[left_count - 1];
+        *left_node.internal_node_right_count() = counts[left_count - 1];
+        new_separator = keys[left_count - 1];
+
+        uint32_t right_count = children.size() - left_count;
+        *right_node.internal_node_num_keys() = right_count - 1;
+        memcpy(right_node.internal_node_keys(), keys.data() + left_count, (right_count - 1) * INTERNAL_NODE_KEY_SIZE);
+        memcpy(right_node.internal_node_children(), children.data() + left_count,
+               (right_count - 1) * INTERNAL_NODE_CHILD_SIZE);
+        memcpy(right_node.internal_node_counts(), counts.data() + left_count,
+               (right_count - 1) * INTERNAL_NODE_COUNT_SIZE);
+        *right_node.internal_node_right_child() = children.back();
+        *right_node.internal_node_right_count() = counts.back();
+    }
+    pager.unpin_page(right_page_num);
+    pager.unpin_page(left_page_num);
+    return new_separator;
+}
+
+void Table::rebalance(vector<uint32_t> &parents, uint32_t page_num)
+{
+    /*
+    Called after cells were removed from page_num, with the path of
+    internal pages above it. An underfull node merges with a neighbour
+    if both fit in one page, which takes a child from the parent, and
+    the parent is checked in turn; otherwise the two share their cells.
+    Parent keys may stay above the real maximum of a child after a
+    delete; they still separate the children correctly. A root left
+    with one child takes over that child's contents, so the tree
+    loses a level.
+    */
+    while(!parents.empty() && is_underfull(page_num))
+    {
+        uint32_t parent_page_num = parents.back();
+        parents.pop_back();
+        InternalNode parent = pager.get_page(parent_page_num);
+        uint32_t num_keys = *parent.internal_node_num_keys();
+        uint32_t index = 0;
+        while(index < num_keys && *parent.internal_node_child(index) != page_num)
+        {
+            index++;
+        }
+
+        // Pair with the right neighbour, or the left one for the right child
+        uint32_t left_index = index < num_keys ? index : index - 1;
+        uint32_t left_page_num = *parent.internal_node_child(left_index);
+        uint32_t right_page_num = *parent.internal_node_child(left_index + 1);
+        uint32_t separator = *parent.internal_node_key(left_index);
+        pager.mark_dirty(parent_page_num);
+
+        if(!merge_nodes(left_page_num, right_page_num, separator))
+        {
+            *parent.internal_node_key(left_index) = redistribute_nodes(left_page_num, right_page_num, separator);
+            recount_child(parent, left_index);
+            recount_child(parent, left_index + 1);
+            pager.unpin_page(parent_page_num);
+            return;
+        }
+
+        // The merged node takes the right one's place and key
+        *parent.internal_node_child(left_index + 1) = left_page_num;
+        memmove(parent.internal_node_key(left_index), parent.internal_node_key(left_index + 1),
+                (num_keys - left_index - 1) * INTERNAL_NODE_KEY_SIZE);
+        memmove(parent.internal_node_children() + left_index, parent.internal_node_children() + left_index + 1,
+                (num_keys - left_index - 1) * INTERNAL_NODE_CHILD_SIZE);
+        memmove(parent.internal_node_counts() + left_index, parent.internal_node_counts() + left_index + 1,
+                (num_keys - left_index - 1) * INTERNAL_NODE_COUNT_SIZE);
+        *parent.internal_node_num_keys() = num_keys - 1;
+        recount_child(parent, left_index);
+        pager.unpin_page(parent_page_num);
+        free_page(right_page_num);
+        page_num = parent_page_num;
+    }
+
+    while(true)
+    {
+        InternalNode root = pager.get_page(root_page_num);
+        if(root.get_node_type() != NODE_INTERNAL || *root.internal_node_num_keys() > 0)
+        {
+            pager.unpin_page(root_page_num);
+            return;
+        }
+        uint32_t child_page_num = *root.internal_node_right_child();
+        Node child = pager.get_page(child_page_num);
+        memcpy(root.get_node(), child.get_node(), PAGE_SIZE);
+        root.set_node_root(true);
+        *root.node_parent() = schema_page_num;
+        pager.mark_dirty(root_page_num);
+        pager.unpin_page(child_page_num);
+        pager.unpin_page(root_page_num);
+        free_page(child_page_num);
+    }
+}
+
+void Table::commit(unique_lock<shared_mutex> &lock)
+{
+    /*
+    Commit the changes made under lock and release it before waiting
+    for the log sync, so the next writer can change the table meanwhile
+    and concurrent commits share one sync.
+    */
+    uint64_t commit_offset = log_commit(true);
+    lock.unlock();
+    pager.wait_commit(commit_offset);
+}
+
+void Table::commit(shared_lock<shared_mutex> &lock)
+{
+    // The same after insert_row_shared, leaving any checkpoint to a
+    // change that has the table to itself
+    uint64_t commit_offset = log_commit(false);
+    lock.unlock();
+    pager.wait_commit(commit_offset);
+}
+
+uint64_t Table::log_commit(bool may_checkpoint)
+{
+    // Inserts beside others may be under way; wait for them to finish
+    // so that the log gets whole ones
+    unique_lock<shared_mutex> in_place(in_place_latch);
+    return pager.log_commit(may_checkpoint);
+}
+
+uint32_t Table::schema_page()
+{
+    // The schema page, created with the file
+    if(schema_page_num == 0)
+    {
+        uint32_t format[2] = {DB_FORMAT_MAGIC, DB_FORMAT_VERSION};
+        schema_page_num = pager.get_unused_page_num();
+        Node schema = pager.get_page(schema_page_num);
+        schema.set_node_type(NODE_SCHEMA);
+        memcpy((char *)schema.get_node() + SCHEMA_FORMAT_MAGIC_OFFSET, format, sizeof(format));
+        pager.mark_dirty(schema_page_num);
+        pager.unpin_page(schema_page_num);
+
+        Node root_node = pager.get_page(root_page_num);
+        *root_node.node_parent() = schema_page_num;
+        pager.mark_dirty(root_page_num);
+        pager.unpin_page(root_page_num);
+    }
+    return schema_page_num;
+}
+
+uint32_t Table::allocate_page()
+{
+    /*
+    Return a page for a new node: the head of the free list, zeroed
+    like a page past the end of the file, or a new page if the list
+    is empty. The caller pins it with get_page as usual.
+    */
+    if(free_page_num == 0)
+    {
+        return pager.get_unused_page_num();
+    }
+    uint32_t page_num = free_page_num;
+    Node page = pager.get_page(page_num);
+    memcpy(&free_page_num, (char *)page.get_node() + FREE_PAGE_NEXT_OFFSET, sizeof(free_page_num));
+    memset(page.get_node(), 0, PAGE_SIZE);
+    pager.mark_dirty(page_num);
+    pager.unpin_page(page_num);
+
+    Node schema = pager.get_page(schema_page_num);
+    memcpy((char *)schema.get_node() + SCHEMA_FREE_PAGE_OFFSET, &free_page_num, sizeof(free_page_num));
+    pager.mark_dirty(schema_page_num);
+    pager.unpin_page(schema_page_num);
+    return page_num;
+}
+
+void Table::free_page(uint32_t page_num)
+{
+    // Put a page that no node refers to any more on the free list
+    schema_page();
+    Node page = pager.get_page(page_num);
+    memset(page.get_node(), 0, PAGE_SIZE);
+    page.set_node_type(NODE_FREE);
+    memcpy((char *)page.get_node() + FREE_PAGE_NEXT_OFFSET, &free_page_num, sizeof(free_page_num));
+    pager.mark_dirty(page_num);
+    pager.unpin_page(page_num);
+    free_page_num = page_num;
+
+    Node schema = pager.get_page(schema_page_num);
+    memcpy((char *)schema.get_node() + SCHEMA_FREE_PAGE_OFFSET, &free_page_num, sizeof(free_page_num));
+    pager.mark_dirty(schema_page_num);
+    pager.unpin_page(schema_page_num);
+}
+
+void Table::visit_page_refs(uint32_t page_num, function<void(uint32_t &)> visit)
+{
+    /*
+    Call visit on every page number a page holds, which may change it:
+    children and leaf links in both kinds of tree, the index roots in
+    the schema page and the schema page in the table root. 0 stands for
+    no page wherever it appears. The page is marked dirty if a number
+    changed.
+    */
+    Node node = pager.get_page(page_num);
+    NodeType type = node.get_node_type();
+    bool changed = false;
+    auto visit_field = [&](void *field) {
+        uint32_t value;
+        memcpy(&value, field, sizeof(value));
+        uint32_t old_value = value;
+        visit(value);
+        if(value != old_value)
+        {
+            memcpy(field, &value, sizeof(value));
+            changed = true;
+        }
+    };
+
+    if(type == NODE_INTERNAL)
+    {
+        InternalNode internal_node = node.get_node();
+        for(uint32_t i = 0; i < *internal_node.internal_node_num_keys(); i++)
+        {
+            visit_field(internal_node.internal_node_child(i));
+        }
+        visit_field(internal_node.internal_node_right_child());
+    }
+    else if(type == NODE_LEAF || type == NODE_INDEX_LEAF || type == NODE_INDEX_INTERNAL)
+    {
+        // Index internal cells start with their child, the right child
+        // is in the next leaf field
+        LeafNode leaf_node = node.get_node();
+        if(type == NODE_INDEX_INTERNAL)
+        {
+            for(uint32_t i = 0; i < *leaf_node.leaf_node_num_cells(); i++)
+            {
+                visit_field(leaf_node.leaf_node_value(i));
+            }
+        }
+        visit_field(leaf_node.leaf_node_next_leaf());
+    }
+    else if(type == NODE_SCHEMA)
+    {
+        for(uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++)
+        {
+            visit_field((char *)node.get_node() + SCHEMA_INDEX_ROOTS_OFFSET + column * sizeof(uint32_t));
+        }
+    }
+    if(page_num == root_page_num)
+    {
+        visit_field(node.node_parent());
+    }
+
+    if(changed)
+    {
+        pager.mark_dirty(page_num);
+    }
+    pager.unpin_page(page_num);
+}
+
+uint32_t Table::vacuum()
+{
+    /*
+    Shrink the file to its live pages and return how many pages were
+    cut off. Each index is rebuilt first, fully packed, into the pages
+    of the old one. The live pages are then those reachable from the
+    table root, which leads to the schema page and the index trees;
+    everything else is on the free list or was leaked by a crash. Each
+    live page at or past the live count is copied into a free page
+    below it, then every reference is pointed at the copies. Nothing
+    commits until the checkpoint at the end, spilling to the log as it
+    goes, so a crash leaves the file as it was. The tail is cut off
+    after the checkpoint.
+    */
+    for(uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++)
+    {
+        if(index_root_page_nums[column] != 0)
+        {
+            index_free(index_root_page_nums[column]);
+            index_root_page_nums[column] = 0;
+            create_index((IndexColumn)column);
+            pager.spill();
+        }
+    }
+
+    free_page_num = 0;
+    if(schema_page_num != 0)
+    {
+        Node schema = pager.get_page(schema_page_num);
+        memcpy((char *)schema.get_node() + SCHEMA_FREE_PAGE_OFFSET, &free_page_num, sizeof(free_page_num));
+        pager.mark_dirty(schema_page_num);
+        pager.unpin_page(schema_page_num);
+    }
+
+    uint32_t num_pages = pager.num_pages;
+    vector<bool> live(num_pages, false);
+    vector<uint32_t> pending(1, root_page_num);
+    live[root_page_num] = true;
+    uint32_t live_count = 1;
+    while(!pending.empty())
+    {
+        uint32_t page_num = pending.back();
+        pending.pop_back();
+        visit_page_refs(page_num, [&](uint32_t &ref) {
+            if(ref >= num_pages)
+            {
+                cout << "Page " << page_num << " refers to page " << ref << " past the end. Corrupt file." << endl;
+                exit(EXIT_FAILURE);
+            }
+            if(ref != 0 && !live[ref])
+            {
+                live[ref] = true;
+                live_count++;
+                pending.push_back(ref);
+            }
+        });
+    }
+
+    unordered_map<uint32_t, uint32_t> new_page_nums;
+    uint32_t free_slot = 0;
+    for(uint32_t page_num = live_count; page_num < num_pages; page_num++)
+    {
+        if(!live[page_num])
+        {
+            continue;
+        }
+        while(live[free_slot])
+        {
+            free_slot++;
+        }
+        live[free_slot] = true;
+        new_page_nums[page_num] = free_slot;
+
+        Node source = pager.get_page(page_num);
+        Node destination = pager.get_page(free_slot);
+        memcpy(destination.get_node(), source.get_node(), PAGE_SIZE);
+        pager.mark_dirty(free_slot);
+        pager.unpin_page(free_slot);
+        pager.unpin_page(page_num);
+        pager.spill();
+    }
+
+    auto relocate = [&new_page_nums](uint32_t &page_num) {
+        auto it = new_page_nums.find(page_num);
+        if(it != new_page_nums.end())
+        {
+            page_num = it->second;
+        }
+    };
+    for(uint32_t page_num = 0; page_num < live_count; page_num++)
+    {
+        visit_page_refs(page_num, relocate);
+        pager.spill();
+    }
+    relocate(schema_page_num);
+    for(uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++)
+    {
+        relocate(index_root_page_nums[column]);
+    }
+
+    pager.checkpoint();
+    pager.truncate(live_count);
+    return num_pages - live_count;
+}
+
+uint32_t Table::bulk_load(function<bool(Row &)> next_row, uint32_t fill_percent)
+{
+    /*
+    Build the tree bottom-up from rows delivered in strictly increasing
+    key order. Leaves are filled to fill_percent of their bytes and
+    linked left to
+    right, then each internal level is built over the one below until a
+    single node is left, which becomes the root in root_page_num. All
+    other pages are appended to the file in large sequential writes and
+    synced before the root is replaced, so a crash leaves either the old
+    empty root or the complete tree. Returns the number of rows loaded.
+    */
+    uint32_t bytes_per_leaf = LEAF_NODE_SPACE_FOR_CELLS * fill_percent / 100;
+    uint32_t children_per_node = max(2u, INTERNAL_NODE_MAX_KEYS * fill_percent / 100 + 1);
+
+    vector<pair<uint32_t, uint32_t>> level; // page number and max key of each node
+    vector<uint32_t> level_counts;          // rows under each node
+    vector<char> buffer;                    // built pages not yet written
+    uint32_t buffer_first_page_num = pager.get_unused_page_num();
+    uint32_t num_rows = 0;
+
+    // Leaf level
+    Row row;
+    char serialized_row[ROW_MAX_SIZE];
+    while(next_row(row))
+    {
+        uint32_t row_size = serialize_row(row, serialized_row);
+        if(level.empty() ||
+           LEAF_NODE_SPACE_FOR_CELLS - LeafNode(&buffer[buffer.size() - PAGE_SIZE]).leaf_node_free_space()
+               + LEAF_NODE_SLOT_SIZE + row_size > bytes_per_leaf)
+        {
+            uint32_t new_page_num = buffer_first_page_num + buffer.size() / PAGE_SIZE;
+            if(!level.empty())
+            {
+                *LeafNode(&buffer[buffer.size() - PAGE_SIZE]).leaf_node_next_leaf() = new_page_num;
+            }
+            if(buffer.size() / PAGE_SIZE >= BULK_LOAD_CHUNK_PAGES)
+            {
+                pager.write_new_pages(buffer_first_page_num, buffer.data(), buffer.size() / PAGE_SIZE);
+                buffer_first_page_num = new_page_num;
+                buffer.clear();
+            }
+            buffer.resize(buffer.size() + PAGE_SIZE, 0);
+            LeafNode(&buffer[buffer.size() - PAGE_SIZE]).initialize_leaf_node();
+            level.push_back(make_pair(new_page_num, 0));
+            level_counts.push_back(0);
+        }
+        LeafNode leaf = &buffer[buffer.size() - PAGE_SIZE];
+        leaf.leaf_node_insert_cell(*leaf.leaf_node_num_cells(), row.id, serialized_row, row_size);
+        level.back().second = row.id;
+        level_counts.back()++;
+        num_rows++;
+    }
+
+    if(num_rows == 0)
+    {
+        return 0;
+    }
+
+    // Internal levels, until one node is left
+    while(level.size() > 1)
+    {
+        if(!buffer.empty())
+        {
+            pager.write_new_pages(buffer_first_page_num, buffer.data(), buffer.size() / PAGE_SIZE);
+            buffer.clear();
+        }
+        buffer_first_page_num = pager.get_unused_page_num();
+
+        // A node needs at least two children, so the last one may take
+        // one from its left neighbour
+        vector<uint32_t> group_sizes((level.size() + children_per_node - 1) / children_per_node,
+                                     children_per_node);
+        group_sizes.back() = level.size() - (group_sizes.size() - 1) * children_per_node;
+        if(group_sizes.back() == 1)
+        {
+            group_sizes[group_sizes.size() - 2] -= 1;
+            group_sizes.back() += 1;
+        }
+
+        vector<pair<uint32_t, uint32_t>> parents;
+        vector<uint32_t> parent_counts;
+        uint32_t child = 0;
+        for(uint32_t group_size : group_sizes)
+        {
+            uint32_t node_page_num = buffer_first_page_num + buffer.size() / PAGE_SIZE;
+            buffer.resize(buffer.size() + PAGE_SIZE, 0);
+            InternalNode node = &buffer[buffer.size() - PAGE_SIZE];
+            node.initialize_internal_node();
+            *node.internal_node_num_keys() = group_size - 1;
+            for(uint32_t i = 0; i < group_size - 1; i++, child++)
+            {
+                *node.internal_node_child(i) = level[child].first;
+                *node.internal_node_key(i) = level[child].second;
+                *node.internal_node_count(i) = level_counts[child];
+            }
+            *node.internal_node_right_child() = level[child].first;
+            *node.internal_node_right_count() = level_counts[child];
+            parents.push_back(make_pair(node_page_num, level[child].second));
+            parent_counts.push_back(node.internal_node_total_count());
+            child++;
+
+            if(buffer.size() / PAGE_SIZE >= BULK_LOAD_CHUNK_PAGES && child < level.size())
+            {
+                pager.write_new_pages(buffer_first_page_num, buffer.data(), buffer.size() / PAGE_SIZE);
+                buffer_first_page_num += buffer.size() / PAGE_SIZE;
+                buffer.clear();
+            }
+        }
+        level = parents;
+        level_counts = parent_counts;
+    }
+
+    // The top level is a single node, still alone in the buffer, which
+    // becomes the root
+    pager.pager_sync();
+
+    Node root = pager.get_page(root_page_num);
+    memcpy(root.get_node(), &buffer[buffer.size() - PAGE_SIZE], PAGE_SIZE);
+    root.set_node_root(true);
+    *root.node_parent() = schema_page_num;
+    pager.mark_dirty(root_page_num);
+    pager.unpin_page(root_page_num);
+
+    return num_rows;
+}
+
+uint32_t Table::index_find_leaf(uint32_t page_num, const char *entry, vector<uint32_t> &parents)
+{
+    // Descend from an index root to the leaf where entry belongs,
+    // recording the internal pages on the way
+    while(true)
+    {
+        LeafNode node = pager.get_page(page_num);
+        if(node.get_node_type() == NODE_INDEX_LEAF)
+        {
+            pager.unpin_page(page_num);
+            return page_num;
+        }
+        uint32_t cell_num = index_node_find_cell(node, INDEX_CHILD_SIZE, entry);
+        uint32_t child_page_num;
+        if(cell_num < *node.leaf_node_num_cells())
+        {
+            memcpy(&child_page_num, node.leaf_node_value(cell_num), INDEX_CHILD_SIZE);
+        }
+        else
+        {
+            child_page_num = *node.leaf_node_next_leaf();
+        }
+        pager.unpin_page(page_num);
+        parents.push_back(page_num);
+        page_num = child_page_num;
+    }
+}
+
+void Table::index_insert(IndexColumn column, string_view value, uint32_t id)
+{
+    char entry[INDEX_ENTRY_MAX_SIZE];
+    uint32_t entry_size = make_index_entry(value, id, entry);
+    uint32_t key = index_entry_key(entry);
+
+    vector<uint32_t> parents;
+    uint32_t page_num = index_find_leaf(index_root_page_nums[column], entry, parents);
+    LeafNode leaf = pager.get_page(page_num);
+    pager.mark_dirty(page_num);
+    uint32_t cell_num = index_node_find_cell(leaf, 0, entry);
+    if(leaf.leaf_node_insert_cell(cell_num, key, entry, entry_size))
+    {
+        pager.unpin_page(page_num);
+        return;
+    }
+
+    // Leaf full
+    vector<IndexCell> cells = index_node_cells(leaf);
+    cells.insert(cells.begin() + cell_num, make_pair(key, string(entry, entry_size)));
+    uint32_t next_leaf = *leaf.leaf_node_next_leaf();
+    pager.unpin_page(page_num);
+    index_store_cells(page_num, parents, cells, next_leaf);
+}
+
+void Table::index_store_cells(uint32_t page_num, vector<uint32_t> &parents, vector<IndexCell> &cells,
+                              uint32_t link)
+{
+    /*
+    Rewrite an index node with cells, or split them in two halves by
+    bytes if they do not fit. The left half keeps the page and gets a
+    new cell in the parent, which may split in turn. A splitting root
+    moves both halves to new pages and becomes their parent, so index
+    roots keep their page number.
+    */
+    LeafNode node = pager.get_page(page_num);
+    NodeType type = node.get_node_type();
+    bool is_root = node.is_node_root();
+    pager.mark_dirty(page_num);
+
+    uint32_t total_bytes = index_cells_bytes(cells);
+    if(total_bytes <= LEAF_NODE_SPACE_FOR_CELLS)
+    {
+        index_node_write(node, type, is_root, cells.begin(), cells.end(), link);
+        pager.unpin_page(page_num);
+        return;
+    }
+
+    uint32_t left_count = index_split_count(cells, total_bytes);
+
+    /*
+    The last entry of the left half separates the halves. An internal
+    left half gives up its last cell, whose child becomes its right
+    child; a left leaf links to the right one.
+    */
+    IndexCell &last_left = cells[left_count - 1];
+    string separator = last_left.second;
+    vector<IndexCell>::iterator left_end = cells.begin() + left_count;
+    uint32_t left_link = 0;
+    if(type == NODE_INDEX_INTERNAL)
+    {
+        separator = separator.substr(INDEX_CHILD_SIZE);
+        left_link = index_cell_child(last_left);
+        left_end--;
+    }
+
+    uint32_t right_page_num = allocate_page();
+    LeafNode right = pager.get_page(right_page_num);
+    pager.mark_dirty(right_page_num);
+    index_node_write(right, type, false, cells.begin() + left_count, cells.end(), link);
+    pager.unpin_page(right_page_num);
+    if(type == NODE_INDEX_LEAF)
+    {
+        left_link = right_page_num;
+    }
+
+    uint32_t left_page_num = is_root ? allocate_page() : page_num;
+    LeafNode left = pager.get_page(left_page_num);
+    pager.mark_dirty(left_page_num);
+    index_node_write(left, type, false, cells.begin(), left_end, left_link);
+    pager.unpin_page(left_page_num);
+
+    if(is_root)
+    {
+        vector<IndexCell> root_cells(1, make_index_child_cell(left_page_num, separator));
+        index_node_write(node, NODE_INDEX_INTERNAL, true, root_cells.begin(), root_cells.end(), right_page_num);
+        pager.unpin_page(page_num);
+        return;
+    }
+    pager.unpin_page(page_num);
+
+    // In the parent the old cell, or the right child, now leads to the
+    // right half, and a new cell before it to the left half
+    uint32_t parent_page_num = parents.back();
+    parents.pop_back();
+    LeafNode parent = pager.get_page(parent_page_num);
+    vector<IndexCell> parent_cells = index_node_cells(parent);
+    uint32_t parent_link = *parent.leaf_node_next_leaf();
+    pager.unpin_page(parent_page_num);
+
+    size_t position = 0;
+    while(position < parent_cells.size() && index_cell_child(parent_cells[position]) != page_num)
+    {
+        position++;
+    }
+    if(position < parent_cells.size())
+    {
+        memcpy(&parent_cells[position].second[0], &right_page_num, INDEX_CHILD_SIZE);
+    }
+    else
+    {
+        parent_link = right_page_num;
+    }
+    parent_cells.insert(parent_cells.begin() + position, make_index_child_cell(page_num, separator));
+    index_store_cells(parent_page_num, parents, parent_cells, parent_link);
+}
+
+void Table::index_remove(IndexColumn column, string_view value, uint32_t id)
+{
+    char entry[INDEX_ENTRY_MAX_SIZE];
+    make_index_entry(value, id, entry);
+    vector<uint32_t> parents;
+    uint32_t page_num = index_find_leaf(index_root_page_nums[column], entry, parents);
+    LeafNode leaf = pager.get_page(page_num);
+    uint32_t cell_num = index_node_find_cell(leaf, 0, entry);
+    bool removed = false;
+    if(cell_num < *leaf.leaf_node_num_cells() &&
+       compare_index_entries((char *)leaf.leaf_node_value(cell_num), entry) == 0)
+    {
+        leaf.leaf_node_remove_cell(cell_num);
+        pager.mark_dirty(page_num);
+        removed = true;
+    }
+    pager.unpin_page(page_num);
+    if(removed)
+    {
+        index_rebalance(index_root_page_nums[column], parents, page_num);
+    }
+}
+
+void Table::index_rebalance(uint32_t root_page_num, vector<uint32_t> &parents, uint32_t page_num)
+{
+    /*
+    The index counterpart of rebalance, working on whole cell lists.
+    An underfull node merges with a neighbour if both fit in one page,
+    and the parent loses a cell and is checked in turn; otherwise the
+    two are split again evenly by bytes and the parent gets the new
+    separator, which can be longer than the old one, so the parent is
+    stored with index_store_cells and may split. A root left with only
+    its right child takes over that child's contents, keeping its page.
+    */
+    while(!parents.empty() && is_underfull(page_num))
+    {
+        uint32_t parent_page_num = parents.back();
+        parents.pop_back();
+        LeafNode parent = pager.get_page(parent_page_num);
+        vector<IndexCell> parent_cells = index_node_cells(parent);
+        uint32_t parent_link = *parent.leaf_node_next_leaf();
+        pager.unpin_page(parent_page_num);
+
+        size_t position = 0;
+        while(position < parent_cells.size() && index_cell_child(parent_cells[position]) != page_num)
+        {
+            position++;
+        }
+
+        // Pair with the right neighbour, or the left one for the right child
+        size_t left_position = position < parent_cells.size() ? position : position - 1;
+        uint32_t left_page_num = index_cell_child(parent_cells[left_position]);
+        uint32_t right_page_num = left_position + 1 < parent_cells.size()
+                                  ? index_cell_child(parent_cells[left_position + 1]) : parent_link;
+        string separator = parent_cells[left_position].second.substr(INDEX_CHILD_SIZE);
+
+        // An internal left node's right child comes back as a cell
+        // with the parent's separator
+        LeafNode left = pager.get_page(left_page_num);
+        NodeType type = left.get_node_type();
+        vector<IndexCell> cells = index_node_cells(left);
+        if(type == NODE_INDEX_INTERNAL)
+        {
+            cells.push_back(make_index_child_cell(*left.leaf_node_next_leaf(), separator));
+        }
+        LeafNode right = pager.get_page(right_page_num);
+        vector<IndexCell> right_cells = index_node_cells(right);
+        cells.insert(cells.end(), right_cells.begin(), right_cells.end());
+        uint32_t link = *right.leaf_node_next_leaf();
+        pager.mark_dirty(left_page_num);
+        pager.mark_dirty(right_page_num);
+
+        uint32_t total_bytes = index_cells_bytes(cells);
+        if(total_bytes <= LEAF_NODE_SPACE_FOR_CELLS)
+        {
+            // The merged node takes the right one's place in the parent
+            index_node_write(left, type, false, cells.begin(), cells.end(), link);
+            pager.unpin_page(right_page_num);
+            pager.unpin_page(left_page_num);
+            free_page(right_page_num);
+            parent_cells.erase(parent_cells.begin() + left_position);
+            if(left_position < parent_cells.size())
+            {
+                memcpy(&parent_cells[left_position].second[0], &left_page_num, INDEX_CHILD_SIZE);
+            }
+            else
+            {
+                parent_link = left_page_num;
+            }
+            index_store_cells(parent_page_num, parents, parent_cells, parent_link);
+            page_num = parent_page_num;
+            continue;
+        }
+
+        uint32_t left_count = index_split_count(cells, total_bytes);
+        IndexCell &last_left = cells[left_count - 1];
+        string new_separator = last_left.second;
+        vector<IndexCell>::iterator left_end = cells.begin() + left_count;
+        uint32_t left_link = right_page_num;
+        if(type == NODE_INDEX_INTERNAL)
+        {
+            new_separator = new_separator.substr(INDEX_CHILD_SIZE);
+            left_link = index_cell_child(last_left);
+            left_end--;
+        }
+        index_node_write(right, type, false, cells.begin() + left_count, cells.end(), link);
+        index_node_write(left, type, false, cells.begin(), left_end, left_link);
+        pager.unpin_page(right_page_num);
+        pager.unpin_page(left_page_num);
+        parent_cells[left_position] = make_index_child_cell(left_page_num, new_separator);
+        index_store_cells(parent_page_num, parents, parent_cells, parent_link);
+        return;
+    }
+
+    while(true)
+    {
+        LeafNode root = pager.get_page(root_page_num);
+        if(root.get_node_type() != NODE_INDEX_INTERNAL || *root.leaf_node_num_cells() > 0)
+        {
+            pager.unpin_page(root_page_num);
+            return;
+        }
+        uint32_t child_page_num = *root.leaf_node_next_leaf();
+        Node child = pager.get_page(child_page_num);
+        uint32_t parent_page_num = *root.node_parent();
+        memcpy(root.get_node(), child.get_node(), PAGE_SIZE);
+        root.set_node_root(true);
+        *root.node_parent() = parent_page_num;
+        pager.mark_dirty(root_page_num);
+        pager.unpin_page(child_page_num);
+        pager.unpin_page(root_page_num);
+        free_page(child_page_num);
+    }
+}
+
+void Table::index_free(uint32_t root_page_num)
+{
+    // Put every page of an index tree on the free list
+    vector<uint32_t> pending(1, root_page_num);
+    while(!pending.empty())
+    {
+        uint32_t page_num = pending.back();
+        pending.pop_back();
+        LeafNode node = pager.get_page(page_num);
+        if(node.get_node_type() == NODE_INDEX_INTERNAL)
+        {
+            for(IndexCell &cell : index_node_cells(node))
+            {
+                pending.push_back(index_cell_child(cell));
+            }
+            pending.push_back(*node.leaf_node_next_leaf());
+        }
+        pager.unpin_page(page_num);
+        free_page(page_num);
+        pager.spill();
+    }
+}
+
+void Table::index_row(Row &row)
+{
+    // Add a new row to every index
+    if(index_root_page_nums[INDEX_USERNAME] != 0)
+    {
+        index_insert(INDEX_USERNAME, row.username, row.id);
+    }
+    if(index_root_page_nums[INDEX_EMAIL] != 0)
+    {
+        index_insert(INDEX_EMAIL, row.email, row.id);
+    }
+}
+
+void Table::unindex_row(Row &row)
+{
+    // Remove a deleted row from every index
+    if(index_root_page_nums[INDEX_USERNAME] != 0)
+    {
+        index_remove(INDEX_USERNAME, row.username, row.id);
+    }
+    if(index_root_page_nums[INDEX_EMAIL] != 0)
+    {
+        index_remove(INDEX_EMAIL, row.email, row.id);
+    }
+}
+
+void Table::index_fill(IndexColumn column)
+{
+    /*
+    Add every row of the table to an index. The entries are sorted
+    first, so the inserts walk the index left to right, and like batch
+    inserts they spill to the log to keep the pool from filling with
+    uncommitted pages.
+    */
+    vector<pair<string, uint32_t>> entries;
+    scan_rows(0, UINT32_MAX, [&entries, column](const RowView &row) {
+        entries.push_back(make_pair(string(index_column_value(row, column)), row.id()));
+        return true;
+    });
+    sort(entries.begin(), entries.end());
+    for(pair<string, uint32_t> &entry : entries)
+    {
+        index_insert(column, entry.first, entry.second);
+        pager.spill();
+    }
+}
+
+ExecuteResult Table::create_index(IndexColumn column)
+{
+    if(index_root_page_nums[column] != 0)
+    {
+        return EXECUTE_INDEX_EXISTS;
+    }
+
+    uint32_t index_root_page_num = allocate_page();
+    LeafNode index_root = pager.get_page(index_root_page_num);
+    index_root.initialize_leaf_node();
+    index_root.set_node_type(NODE_INDEX_LEAF);
+    index_root.set_node_root(true);
+    pager.mark_dirty(index_root_page_num);
+    pager.unpin_page(index_root_page_num);
+    index_root_page_nums[column] = index_root_page_num;
+
+    // The index is filled before the schema records it, so a fill that
+    // commits in parts never leaves a partial index reachable
+    index_fill(column);
+
+    uint32_t page_num = schema_page();
+    Node schema = pager.get_page(page_num);
+    memcpy((char *)schema.get_node() + SCHEMA_INDEX_ROOTS_OFFSET, index_root_page_nums,
+           sizeof(index_root_page_nums));
+    pager.mark_dirty(page_num);
+    pager.unpin_page(page_num);
+    return EXECUTE_SUCCESS;
+}
+
+void Table::find_rows_by(IndexColumn column, const string &value, bool prefix,
+                         function<bool(const RowView &)> callback)
+{
+    /*
+    Rows whose column equals value, or starts with it if prefix is
+    set, until callback returns false. With an index the matching
+    entries follow one descent and each row is fetched by id, in value
+    then id order; without one every row is checked, in id order.
+    */
+    auto matches = [&value, prefix](string_view candidate) {
+        return column_matches(candidate, value, prefix);
+    };
+    if(index_root_page_nums[column] == 0)
+    {
+        scan_rows(0, UINT32_MAX, [&matches, &callback, column](const RowView &row) {
+            return !matches(index_column_value(row, column)) || callback(row);
+        });
+        return;
+    }
+
+    char entry[INDEX_ENTRY_MAX_SIZE];
+    make_index_entry(value, 0, entry);
+    vector<uint32_t> parents;
+    uint32_t page_num = index_find_leaf(index_root_page_nums[column], entry, parents);
+    LeafNode leaf = pager.get_page(page_num);
+    uint32_t cell_num = index_node_find_cell(leaf, 0, entry);
+    while(true)
+    {
+        if(cell_num == *leaf.leaf_node_num_cells())
+        {
+            uint32_t next_page_num = *leaf.leaf_node_next_leaf();
+            if(next_page_num == 0)
+            {
+                break;
+            }
+            pager.unpin_page(page_num);
+            page_num = next_page_num;
+            leaf = pager.get_page(page_num);
+            cell_num = 0;
+            continue;
+        }
+
+        const char *found = (const char *)leaf.leaf_node_value(cell_num);
+        if(!matches(index_entry_value(found)))
+        {
+            break;
+        }
+        bool more = true;
+        find_row(index_entry_id(found), [&more, &callback](const RowView &row) { more = callback(row); });
+        if(!more)
+        {
+            break;
+        }
+        cell_num++;
+    }
+    pager.unpin_page(page_num);
+}
+
+#define SCAN_MAX_WORKERS 16       // threads a parallel scan uses at most
+#define SCAN_PARTS_PER_WORKER 4   // key ranges per thread, so the work evens out
+
+vector<pair<uint32_t, uint32_t>> Table::split_key_range(uint32_t low, uint32_t high, uint32_t num_parts)
+{
+    /*
+    Cut [low, high] into consecutive ranges at the separator keys of
+    the root, adding those of each level below until there are enough
+    for num_parts, so a range covers one or a few subtrees. Any sorted
+    set of cut points splits the keys correctly, so separators that
+    became stale upper bounds after deletes do no harm.
+    */
+    vector<uint32_t> separators;
+    vector<uint32_t> level(1, root_page_num);
+    while(!level.empty() && separators.size() + 1 < num_parts)
+    {
+        vector<uint32_t> next_level;
+        for(uint32_t page_num : level)
+        {
+            InternalNode node = pager.get_page(page_num);
+            if(node.get_node_type() == NODE_INTERNAL)
+            {
+                uint32_t num_keys = *node.internal_node_num_keys();
+                separators.insert(separators.end(), node.internal_node_keys(), node.internal_node_keys() + num_keys);
+                next_level.insert(next_level.end(), node.internal_node_children(),
+                                  node.internal_node_children() + num_keys);
+                next_level.push_back(*node.internal_node_right_child());
+            }
+            pager.unpin_page(page_num);
+        }
+        level = next_level;
+    }
+    sort(separators.begin(), separators.end());
+
+    vector<pair<uint32_t, uint32_t>> ranges;
+    uint32_t start = low;
+    for(uint32_t separator : separators)
+    {
+        if(separator >= start && separator < high)
+        {
+            ranges.push_back(make_pair(start, separator));
+            start = separator + 1;
+        }
+    }
+    ranges.push_back(make_pair(start, high));
+    return ranges;
+}
+
+void Table::parallel_scan(uint32_t low, uint32_t high, uint32_t num_workers,
+                          function<void(uint32_t, const RowView &)> visit)
+{
+    /*
+    Visit the rows with keys in [low, high] from up to num_workers
+    threads, in no particular order. visit gets the number of the
+    worker calling it, so results can be kept per worker and merged
+    afterwards. Each worker takes the next unscanned range when it
+    finishes one, so a dense range does not hold up the others. The
+    caller holds the table latch for all of them. Every worker pins a
+    page or two, so a small pool gets fewer workers.
+    */
+    vector<pair<uint32_t, uint32_t>> ranges = split_key_range(low, high, num_workers * SCAN_PARTS_PER_WORKER);
+    num_workers = min(num_workers, (uint32_t)ranges.size());
+    if(pager.backend != PAGER_MMAP)
+    {
+        num_workers = max(1u, min(num_workers, pager.pool_size / 4));
+    }
+
+    atomic<uint32_t> next_range(0);
+    auto work = [&](uint32_t worker) {
+        uint32_t range;
+        while((range = next_range++) < ranges.size())
+        {
+            scan_rows(ranges[range].first, ranges[range].second, [&visit, worker](const RowView &row) {
+                visit(worker, row);
+                return true;
+            });
+        }
+    };
+    vector<thread> threads;
+    for(uint32_t worker = 1; worker < num_workers; worker++)
+    {
+        threads.emplace_back(work, worker);
+    }
+    work(0);
+    for(thread &worker_thread : threads)
+    {
+        worker_thread.join();
+    }
+}
+
+bool Table::aggregate_rows(Statement &statement, uint64_t &value)
+{
+    /*
+    Compute count(*), min(id) or max(id) over the rows a select picks;
+    false for min or max of no rows. An unfiltered select subtracts the
+    ranks of the range ends, read from the subtree counts, for its
+    count; min and max are the rows at the first and last of those
+    ranks, each found by one descent. A filter on an indexed column
+    follows the index; anything else is a parallel scan whose
+    per-worker totals are merged at the end.
+    */
+    struct alignas(64) ScanTotals   // one cache line per worker
+    {
+        uint64_t count = 0;
+        uint32_t min_id = UINT32_MAX;
+        uint32_t max_id = 0;
+
+        void add(uint32_t id)
+        {
+            count++;
+            min_id = min(min_id, id);
+            max_id = max(max_id, id);
+        }
+    };
+    ScanTotals totals;
+    bool filtered = statement.type == STATEMENT_FIND;
+
+    if(!filtered)
+    {
+        unique_lock<shared_mutex> counts(in_place_latch);
+        uint64_t end = statement.range_end == UINT32_MAX ? node_row_count(root_page_num)
+                                                         : count_rows_below(statement.range_end + 1);
+        uint64_t start = count_rows_below(statement.range_start);
+        totals.count = end > start ? end - start : 0;
+        if(statement.aggregate != AGGREGATE_COUNT && totals.count > 0)
+        {
+            Cursor *cursor = table_seek_position(statement.aggregate == AGGREGATE_MIN ? start : end - 1);
+            totals.min_id = totals.max_id = cursor->cursor_key();
+            delete cursor;
+        }
+    }
+    else if(index_root_page_nums[statement.column] != 0)
+    {
+        find_rows_by(statement.column, statement.value, statement.prefix, [&totals](const RowView &row) {
+            totals.add(row.id());
+            return true;
+        });
+    }
+    else
+    {
+        uint32_t num_workers = max(1u, min(thread::hardware_concurrency(), (uint32_t)SCAN_MAX_WORKERS));
+        vector<ScanTotals> worker_totals(num_workers);
+        parallel_scan(statement.range_start, statement.range_end, num_workers,
+                      [&worker_totals, &statement, filtered](uint32_t worker, const RowView &row) {
+            if(!filtered || column_matches(index_column_value(row, statement.column), statement.value,
+                                           statement.prefix))
+            {
+                worker_totals[worker].add(row.id());
+            }
+        });
+        for(ScanTotals &partial : worker_totals)
+        {
+            totals.count += partial.count;
+            totals.min_id = min(totals.min_id, partial.min_id);
+            totals.max_id = max(totals.max_id, partial.max_id);
+        }
+    }
+
+    switch(statement.aggregate)
+    {
+        case AGGREGATE_MIN:
+            value = totals.min_id;
+            break;
+        case AGGREGATE_MAX:
+            value = totals.max_id;
+            break;
+        default:
+            value = totals.count;
+            return true;
+    }
+    return totals.count > 0;
+}
+
+Table::~Table()
+{
+    pager.pager_close();
+}
+
+class RowReader
+{
+    /*
+    Reads rows for .import, either from a CSV file with one
+    "id,username,email" line per row or, for any other extension, from
+    a binary file of fixed-width ROW_SIZE records.
+    */
+private:
+    ifstream input;
+    bool binary;
+    uint64_t line_num;
+
+public:
+    string error;
+
+    RowReader(const string &filename)
+    {
+        binary = filename.size() < 4 || filename.compare(filename.size() - 4, 4, ".csv") != 0;
+        input.open(filename, binary ? ios::in | ios::binary : ios::in);
+        line_num = 0;
+        if(!input.is_open())
+        {
+            error = "cannot open file " + filename;
+        }
+    }
+
+    bool read_row(Row &row)
+    {
+        // Returns false at the end of the input or on error
+        if(!error.empty())
+        {
+            return false;
+        }
+
+        if(binary)
+        {
+            char record[ROW_SIZE];
+            if(!input.read(record, ROW_SIZE))
+            {
+                if(input.gcount() != 0)
+                {
+                    error = "truncated record at end of file";
+                }
+                return false;
+            }
+            memcpy(&(row.id), record + ID_OFFSET, ID_SIZE);
+            memcpy(row.username, record + USERNAME_OFFSET, USERNAME_SIZE);
+            memcpy(row.email, record + EMAIL_OFFSET, EMAIL_SIZE);
+            row.username[COLUMN_USERNAME_SIZE] = '\0';
+            row.email[COLUMN_EMAIL_SIZE] = '\0';
+            return true;
+        }
+
+        string line;
+        while(getline(input, line))
+        {
+            line_num++;
+            if(!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            if(line.empty())
+            {
+                continue;
+            }
+
+            size_t first_comma = line.find(',');
+            size_t second_comma = first_comma == string::npos ? string::npos : line.find(',', first_comma + 1);
+            if(second_comma == string::npos || line.find(',', second_comma + 1) != string::npos)
+            {
+                error = "line " + to_string(line_num) + ": expected id,username,email";
+                return false;
+            }
+            string id_string = line.substr(0, first_comma);
+            string username = line.substr(first_comma + 1, second_comma - first_comma - 1);
+            string email = line.substr(second_comma + 1);
+            if(id_string.empty() || id_string.find_first_not_of("0123456789") != string::npos)
+            {
+                error = "line " + to_string(line_num) + ": invalid id";
+                return false;
+            }
+            if(username.size() > COLUMN_USERNAME_SIZE || email.size() > COLUMN_EMAIL_SIZE)
+            {
+                error = "line " + to_string(line_num) + ": string is too long";
+                return false;
+            }
+            row = Row(strtoul(id_string.c_str(), nullptr, 10), username.c_str(), email.c_str());
+            return true;
+        }
+        return false;
+    }
+};
+
+
+bool Statement::bind(uint32_t index, uint32_t value)
+{
+    if(index >= params.size())
+    {
+        return false;
+    }
+    Row &row = type == STATEMENT_INSERT_MANY ? rows_to_insert[params[index].second] : row_to_insert;
+    switch(params[index].first)
+    {
+        case PARAM_ID:
+            row.id = value;
+            return true;
+        case PARAM_KEY:
+            range_start = value;
+            range_end = value;
+            return true;
+        case PARAM_RANGE_START:
+            range_start = value;
+            return true;
+        case PARAM_RANGE_END:
+            range_end = value;
+            return true;
+        case PARAM_LIMIT:
+            limit = value;
+            return true;
+        case PARAM_OFFSET:
+            offset = value;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Statement::bind(uint32_t index, const string &value)
+{
+    if(index >= params.size())
+    {
+        return false;
+    }
+    Row &row = type == STATEMENT_INSERT_MANY ? rows_to_insert[params[index].second] : row_to_insert;
+    switch(params[index].first)
+    {
+        case PARAM_USERNAME:
+            if(value.size() > COLUMN_USERNAME_SIZE)
+            {
+                return false;
+            }
+            strcpy(row.username, value.c_str());
+            return true;
+        case PARAM_EMAIL:
+            if(value.size() > COLUMN_EMAIL_SIZE)
+            {
+                return false;
+            }
+            strcpy(row.email, value.c_str());
+            return true;
+        case PARAM_VALUE:
+            if(value.size() > (column == INDEX_USERNAME ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE))
+            {
+                return false;
+            }
+            this->value = value;
+            return true;
+        default:
+            return false;
+    }
+}
+
+PrepareResult parse_key(const string &token, uint32_t &key)
+{
+    if(!token.empty() && token[0] == '-')
+    {
+        return PREPARE_NEGATIVE_ID;
+    }
+    if(token.empty() || token.size() > 10 || token.find_first_not_of("0123456789") != string::npos ||
+       stoull(token) > UINT32_MAX)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    key = stoul(token);
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult parse_key_or_param(const string &token, uint32_t &key, Statement &statement,
+                                 StatementParam param, uint32_t row_num = 0)
+{
+    // A ? leaves the key at 0 and records a placeholder for it
+    if(token == "?")
+    {
+        key = 0;
+        statement.params.push_back(make_pair(param, row_num));
+        return PREPARE_SUCCESS;
+    }
+    return parse_key(token, key);
+}
+
+const char *parse_string_or_param(const char *token, Statement &statement,
+                                  StatementParam param, uint32_t row_num = 0)
+{
+    if(strcmp(token, "?") == 0)
+    {
+        statement.params.push_back(make_pair(param, row_num));
+        return "";
+    }
+    return token;
+}
+
+PrepareResult prepare_insert_values(const string &input_line, Statement &statement)
+{
+    /*
+    insert values (<id>, <username>, <email>), (<id>, <username>, <email>), ...
+    */
+    statement.type = STATEMENT_INSERT_MANY;
+
+    size_t position = input_line.find("values") + 6;
+    while(true)
+    {
+        size_t open = input_line.find_first_not_of(' ', position);
+        if(open == string::npos || input_line[open] != '(')
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        size_t close = input_line.find(')', open);
+        if(close == string::npos)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        vector<string> fields;
+        istringstream tuple(input_line.substr(open + 1, close - open - 1));
+        string field;
+        while(getline(tuple, field, ','))
+        {
+            size_t first = field.find_first_not_of(' ');
+            size_t last = field.find_last_not_of(' ');
+            if(first == string::npos || field.find(' ', first) < last)
+            {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            fields.push_back(field.substr(first, last - first + 1));
+        }
+        if(fields.size() != 3)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        uint32_t row_num = statement.rows_to_insert.size();
+        uint32_t id;
+        PrepareResult result = parse_key_or_param(fields[0], id, statement, PARAM_ID, row_num);
+        if(result != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+        if(fields[1].size() > COLUMN_USERNAME_SIZE || fields[2].size() > COLUMN_EMAIL_SIZE)
+        {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        const char *username = parse_string_or_param(fields[1].c_str(), statement, PARAM_USERNAME, row_num);
+        const char *email = parse_string_or_param(fields[2].c_str(), statement, PARAM_EMAIL, row_num);
+        statement.rows_to_insert.push_back(Row(id, username, email));
+
+        position = input_line.find_first_not_of(' ', close + 1);
+        if(position == string::npos)
+        {
+            return PREPARE_SUCCESS;
+        }
+        if(input_line[position] != ',')
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        position++;
+    }
+}
+
+PrepareResult prepare_insert(const string &input_line, Statement &statement)
+{
+    if(!input_line.compare(0, 14, "insert values "))
+    {
+        return prepare_insert_values(input_line, statement);
+    }
+    statement.type = STATEMENT_INSERT;
+
+    string line = input_line;
+    strtok(&line[0], " ");
+    char *id_string = strtok(NULL, " ");
+    char *username = strtok(NULL, " ");
+    char *email = strtok(NULL, " ");
+
+    if(id_string == NULL || username == NULL || email == NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    uint32_t id = 0;
+    if(strcmp(id_string, "?") == 0)
+    {
+        statement.params.push_back(make_pair(PARAM_ID, 0));
+    }
+    else if(atoi(id_string) < 0)
+    {
+        return PREPARE_NEGATIVE_ID;
+    }
+    else
+    {
+        id = atoi(id_string);
+    }
+    if(strlen(username) > COLUMN_USERNAME_SIZE)
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    if(strlen(email) > COLUMN_EMAIL_SIZE)
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    username = (char *)parse_string_or_param(username, statement, PARAM_USERNAME);
+    email = (char *)parse_string_or_param(email, statement, PARAM_EMAIL);
+    statement.row_to_insert = Row(id, username, email);
+
+    return PREPARE_SUCCESS;
+
+}
+
+PrepareResult prepare_select_by(const string &column, const string &op, istringstream &tokens,
+                                Statement &statement)
+{
+    /*
+    select where <username|email> = <value>
+    select where <username|email> like <prefix>%
+    A ? stands for the value, or for like the prefix without the %.
+    */
+    statement.type = STATEMENT_FIND;
+    statement.column = column == "username" ? INDEX_USERNAME : INDEX_EMAIL;
+    statement.prefix = op == "like";
+
+    string value, token;
+    if(!(tokens >> value) || (tokens >> token) || (op != "=" && op != "like"))
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if(value == "?")
+    {
+        statement.params.push_back(make_pair(PARAM_VALUE, 0));
+        return PREPARE_SUCCESS;
+    }
+    if(statement.prefix)
+    {
+        if(value.find('%') != value.size() - 1)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        value.pop_back();
+    }
+    if(value.size() > (statement.column == INDEX_USERNAME ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE))
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    statement.value = value;
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult prepare_select(const string &input_line, Statement &statement)
+{
+    /*
+    select [where id between <a> and <b>] [limit <n>] [offset <n>]
+    select where id = <n>
+    select where <username|email> ...
+    select <count(*)|min(id)|max(id)> [where ...]
+    */
+    statement.type = STATEMENT_SELECT;
+
+    istringstream tokens(input_line);
+    string token;
+    tokens >> token;
+    if(token != "select")
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    PrepareResult result;
+    string column, low, and_keyword, high;
+    if(!(tokens >> token))
+    {
+        return PREPARE_SUCCESS;
+    }
+    if(token == "count(*)" || token == "min(id)" || token == "max(id)")
+    {
+        statement.aggregate = token == "count(*)" ? AGGREGATE_COUNT :
+                              token == "min(id)" ? AGGREGATE_MIN : AGGREGATE_MAX;
+        if(!(tokens >> token))
+        {
+            return PREPARE_SUCCESS;
+        }
+    }
+    if(token == "where")
+    {
+        string op;
+        if(!(tokens >> column >> op))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if(column == "username" || column == "email")
+        {
+            return prepare_select_by(column, op, tokens, statement);
+        }
+        if(column != "id")
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if(op == "=")
+        {
+            statement.type = STATEMENT_LOOKUP;
+            if(!(tokens >> low))
+            {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            if((result = parse_key_or_param(low, statement.range_start, statement, PARAM_KEY)) != PREPARE_SUCCESS)
+            {
+                return result;
+            }
+            statement.range_end = statement.range_start;
+            return (tokens >> token) ? PREPARE_SYNTAX_ERROR : PREPARE_SUCCESS;
+        }
+        if(!(tokens >> low >> and_keyword >> high) || op != "between" || and_keyword != "and")
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if((result = parse_key_or_param(low, statement.range_start, statement, PARAM_RANGE_START)) != PREPARE_SUCCESS ||
+           (result = parse_key_or_param(high, statement.range_end, statement, PARAM_RANGE_END)) != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+        if(!(tokens >> token))
+        {
+            return PREPARE_SUCCESS;
+        }
+    }
+    if(token == "limit" && statement.aggregate == AGGREGATE_NONE)
+    {
+        string count;
+        if(!(tokens >> count))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if((result = parse_key_or_param(count, statement.limit, statement, PARAM_LIMIT)) != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+        if(!(tokens >> token))
+        {
+            return PREPARE_SUCCESS;
+        }
+    }
+    if(token == "offset" && statement.aggregate == AGGREGATE_NONE)
+    {
+        string count;
+        if(!(tokens >> count))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if((result = parse_key_or_param(count, statement.offset, statement, PARAM_OFFSET)) != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+        return (tokens >> token) ? PREPARE_SYNTAX_ERROR : PREPARE_SUCCESS;
+    }
+    return PREPARE_SYNTAX_ERROR;
+}
+
+PrepareResult prepare_create_index(const string &input_line, Statement &statement)
+{
+    /*
+    create index on <username|email>
+    */
+    statement.type = STATEMENT_CREATE_INDEX;
+
+    istringstream tokens(input_line);
+    string create_keyword, index_keyword, on_keyword, column, token;
+    if(!(tokens >> create_keyword >> index_keyword >> on_keyword >> column) || (tokens >> token) ||
+       create_keyword != "create" || index_keyword != "index" || on_keyword != "on")
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if(column == "username")
+    {
+        statement.column = INDEX_USERNAME;
+    }
+    else if(column == "email")
+    {
+        statement.column = INDEX_EMAIL;
+    }
+    else
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult prepare_delete(const string &input_line, Statement &statement)
+{
+    /*
+    delete where id = <n>
+    delete where id between <a> and <b>
+    */
+    statement.type = STATEMENT_DELETE;
+
+    istringstream tokens(input_line);
+    string delete_keyword, where_keyword, column, op, low, and_keyword, high, token;
+    if(!(tokens >> delete_keyword >> where_keyword >> column >> op >> low) ||
+       delete_keyword != "delete" || where_keyword != "where" || column != "id")
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    PrepareResult result;
+    if(op == "=")
+    {
+        if((result = parse_key_or_param(low, statement.range_start, statement, PARAM_KEY)) != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+        statement.range_end = statement.range_start;
+        return (tokens >> token) ? PREPARE_SYNTAX_ERROR : PREPARE_SUCCESS;
+    }
+    if(op != "between" || !(tokens >> and_keyword >> high) || and_keyword != "and" || (tokens >> token))
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if((result = parse_key_or_param(low, statement.range_start, statement, PARAM_RANGE_START)) != PREPARE_SUCCESS ||
+       (result = parse_key_or_param(high, statement.range_end, statement, PARAM_RANGE_END)) != PREPARE_SUCCESS)
+    {
+        return result;
+    }
+    return PREPARE_SUCCESS;
+}
+
+PrepareResult prepare_statement(const string &text, Statement &statement)
+{
+    if(!text.compare(0, 6, "insert"))
+    {
+        return prepare_insert(text, statement);
+    }
+    else if(!text.compare(0, 6, "select"))
+    {
+        return prepare_select(text, statement);
+    }
+    else if(!text.compare(0, 6, "create"))
+    {
+        return prepare_create_index(text, statement);
+    }
+    else if(!text.compare(0, 6, "delete"))
+    {
+        return prepare_delete(text, statement);
+    }
+    else if(!text.compare(0, 6, "update"))
+    {
+        // update <id> <username> <email> reads like an insert
+        PrepareResult result = prepare_insert(text, statement);
+        statement.type = STATEMENT_UPDATE;
+        return result;
+    }
+    else
+    {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+}
+
+Database::Database(const char *filename, uint32_t pool_size, PagerBackend backend, bool compress)
+{
+    table = new Table(filename, pool_size, backend, compress);
+}
+
+Database::~Database()
+{
+    delete table;
+}
+
+ExecuteResult Database::put(uint32_t id, const string &username, const string &email)
+{
+    if(username.size() > COLUMN_USERNAME_SIZE || email.size() > COLUMN_EMAIL_SIZE)
+    {
+        return EXECUTE_STRING_TOO_LONG;
+    }
+    Row row(id, username.c_str(), email.c_str());
+    ExecuteResult result;
+    {
+        shared_lock<shared_mutex> lock(table->latch);
+        if(table->insert_row_shared(row, result))
+        {
+            table->commit(lock);
+            return result;
+        }
+    }
+    unique_lock<shared_mutex> lock(table->latch);
+    result = table->insert_row(row);
+    table->commit(lock);
+    return result;
+}
+
+ExecuteResult Database::put_many(vector<Row> &rows)
+{
+    unique_lock<shared_mutex> lock(table->latch);
+    ExecuteResult result = table->insert_rows(rows);
+    table->commit(lock);
+    return result;
+}
+
+ExecuteResult Database::update(uint32_t id, const string &username, const string &email)
+{
+    if(username.size() > COLUMN_USERNAME_SIZE || email.size() > COLUMN_EMAIL_SIZE)
+    {
+        return EXECUTE_STRING_TOO_LONG;
+    }
+    Row row(id, username.c_str(), email.c_str());
+    unique_lock<shared_mutex> lock(table->latch);
+    ExecuteResult result = table->update_row(row);
+    table->commit(lock);
+    return result;
+}
+
+uint32_t Database::remove(uint32_t low, uint32_t high)
+{
+    unique_lock<shared_mutex> lock(table->latch);
+    uint32_t num_rows = table->delete_rows(low, high);
+    table->commit(lock);
+    return num_rows;
+}
+
+bool Database::get(uint32_t id, Row &row)
+{
+    shared_lock<shared_mutex> lock(table->latch);
+    return table->find_row(id, [&row](const RowView &view) { row = view.to_row(); });
+}
+
+void Database::scan(uint32_t low, uint32_t high, function<bool(const RowView &)> callback)
+{
+    shared_lock<shared_mutex> lock(table->latch);
+    table->scan_rows(low, high, callback);
+}
+
+ExecuteResult Database::execute(Statement &statement, function<bool(const RowView &)> callback)
+{
+    // Reads share the table, as do inserts that fit their leaf; everything
+    // else has it to itself
+    if(statement.aggregate != AGGREGATE_NONE)
+    {
+        return EXECUTE_AGGREGATE;
+    }
+    ExecuteResult result = EXECUTE_SUCCESS;
+    bool reads_only = statement.type == STATEMENT_SELECT || statement.type == STATEMENT_LOOKUP ||
+                      statement.type == STATEMENT_FIND;
+    if(reads_only)
+    {
+        shared_lock<shared_mutex> lock(table->latch);
+        switch (statement.type)
+        {
+            case STATEMENT_SELECT:
+            {
+                uint32_t num_rows = 0;
+                if(statement.limit > 0)
+                {
+                    table->scan_rows(statement.range_start, statement.range_end,
+                                     [&num_rows, &statement, &callback](const RowView &row) {
+                        return callback(row) && ++num_rows < statement.limit;
+                    }, statement.offset);
+                }
+                break;
+            }
+            case STATEMENT_LOOKUP:
+                table->find_row(statement.range_start, [&callback](const RowView &row) { callback(row); });
+                break;
+            default:
+                table->find_rows_by(statement.column, statement.value, statement.prefix, callback);
+                break;
+        }
+        return result;
+    }
+    if(statement.type == STATEMENT_INSERT)
+    {
+        shared_lock<shared_mutex> lock(table->latch);
+        if(table->insert_row_shared(statement.row_to_insert, result))
+        {
+            table->commit(lock);
+            return result;
+        }
+    }
+
+    unique_lock<shared_mutex> lock(table->latch);
+    switch (statement.type)
+    {
+        case STATEMENT_INSERT:
+            result = table->insert_row(statement.row_to_insert);
+            break;
+        case STATEMENT_INSERT_MANY:
+        {
+            // insert_rows sorts its argument; keep the bound order intact
+            vector<Row> rows = statement.rows_to_insert;
+            result = table->insert_rows(rows);
+            break;
+        }
+        case STATEMENT_CREATE_INDEX:
+            result = table->create_index(statement.column);
+            break;
+        case STATEMENT_DELETE:
+            table->delete_rows(statement.range_start, statement.range_end);
+            break;
+        case STATEMENT_UPDATE:
+            result = table->update_row(statement.row_to_insert);
+            break;
+        default:
+            break;
+    }
+
+    // Every statement commits on its own
+    table->commit(lock);
+    return result;
+}
+
+bool Database::aggregate(Statement &statement, uint64_t &value)
+{
+    shared_lock<shared_mutex> lock(table->latch);
+    return table->aggregate_rows(statement, value);
+}
+
+bool Database::is_empty()
+{
+    shared_lock<shared_mutex> lock(table->latch);
+    return table->is_empty();
+}
+
+bool Database::import_file(const string &filename, uint32_t fill_percent, uint32_t &num_rows, string &error)
+{
+    /*
+    Bulk load an empty table. A first pass validates the input and
+    checks whether it is already sorted; sorted input is then streamed
+    straight into pages, anything else is sorted in memory first.
+    */
+    unique_lock<shared_mutex> lock(table->latch);
+    if(!table->is_empty())
+    {
+        error = "table is not empty";
+        return false;
+    }
+
+    RowReader checker(filename);
+    Row row;
+    bool sorted = true;
+    bool has_previous = false;
+    uint32_t previous_id = 0;
+    while(checker.read_row(row))
+    {
+        if(has_previous && row.id <= previous_id)
+        {
+            sorted = false;
+        }
+        has_previous = true;
+        previous_id = row.id;
+    }
+    if(!checker.error.empty())
+    {
+        error = checker.error;
+        return false;
+    }
+
+    if(sorted)
+    {
+        RowReader reader(filename);
+        num_rows = table->bulk_load([&reader](Row &next) { return reader.read_row(next); },
+                                    fill_percent);
+    }
+    else
+    {
+        vector<Row> rows;
+        RowReader reader(filename);
+        while(reader.read_row(row))
+        {
+            rows.push_back(row);
+        }
+        sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.id < b.id; });
+        for(size_t i = 1; i < rows.size(); i++)
+        {
+            if(rows[i].id == rows[i - 1].id)
+            {
+                error = "Duplicate key.";
+                return false;
+            }
+        }
+        size_t next_index = 0;
+        num_rows = table->bulk_load([&rows, &next_index](Row &next) {
+            if(next_index == rows.size())
+            {
+                return false;
+            }
+            next = rows[next_index++];
+            return true;
+        }, fill_percent);
+    }
+
+    // Indexes on the empty table are filled like batch inserts, in parts
+    // if they outgrow the pool
+    for(uint32_t column = 0; column < INDEX_COLUMN_COUNT; column++)
+    {
+        if(table->index_root_page_nums[column] != 0)
+        {
+            table->index_fill((IndexColumn)column);
+        }
+    }
+
+    table->commit(lock);
+    return true;
+}
+
+ExecuteResult Database::create_index(IndexColumn column)
+{
+    unique_lock<shared_mutex> lock(table->latch);
+    ExecuteResult result = table->create_index(column);
+    table->commit(lock);
+    return result;
+}
+
+void Database::find(IndexColumn column, const string &value, bool prefix,
+                    function<bool(const RowView &)> callback)
+{
+    shared_lock<shared_mutex> lock(table->latch);
+    table->find_rows_by(column, value, prefix, callback);
+}
+
+void Database::checkpoint()
+{
+    unique_lock<shared_mutex> lock(table->latch);
+    table->pager.checkpoint();
+}
+
+uint32_t Database::vacuum()
+{
+    unique_lock<shared_mutex> lock(table->latch);
+    return table->vacuum();
+}
+
+void Database::stats(Stats &stats)
+{
+    shared_lock<shared_mutex> lock(table->latch);
+    table->tree_stats(stats);
+    table->pager.counters.copy_to(stats);
+}
+
+void Database::counters(Stats &stats)
+{
+    table->pager.counters.copy_to(stats);
+}
+
+void Database::set_timing(bool timing)
+{
+    table->pager.counters.timing.store(timing, memory_order_relaxed);
+}
+
+void Database::print_tree()
+{
+    shared_lock<shared_mutex> lock(table->latch);
+    unique_lock<shared_mutex> counts(table->in_place_latch);
+    table->pager.print_tree(table->root_page_num, 0);
+}
+
+void Database::print_constants()
+{
+    cout << "ROW_MAX_SIZE: " << ROW_MAX_SIZE << endl;
+    cout << "COMMON_NODE_HEADER_SIZE: " << COMMON_NODE_HEADER_SIZE << endl;
+    cout << "LEAF_NODE_HEADER_SIZE: " << LEAF_NODE_HEADER_SIZE << endl;
+    cout << "LEAF_NODE_SLOT_SIZE: " << LEAF_NODE_SLOT_SIZE << endl;
+    cout << "LEAF_NODE_SPACE_FOR_CELLS: " << LEAF_NODE_SPACE_FOR_CELLS << endl;
+    cout << "INTERNAL_NODE_MAX_KEYS: " << INTERNAL_NODE_MAX_KEYS << endl;
+}
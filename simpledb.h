@@ -0,0 +1,332 @@
+#ifndef SIMPLEDB_H
+#define SIMPLEDB_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#define DEFAULT_POOL_SIZE 256
+
+enum PrepareResult
+{
+    PREPARE_SUCCESS,
+    PREPARE_NEGATIVE_ID,
+    PREPARE_STRING_TOO_LONG,
+    PREPARE_SYNTAX_ERROR,
+    PREPARE_UNRECOGNIZED_STATEMENT
+};
+
+enum StatementType
+{
+    STATEMENT_INSERT,
+    STATEMENT_INSERT_MANY,
+    STATEMENT_SELECT,
+    STATEMENT_LOOKUP,
+    STATEMENT_FIND,
+    STATEMENT_CREATE_INDEX,
+    STATEMENT_DELETE,
+    STATEMENT_UPDATE
+};
+
+enum ExecuteResult
+{
+    EXECUTE_SUCCESS,
+    EXECUTE_TABLE_FULL,
+    EXECUTE_DUPLICATE_KEY,
+    EXECUTE_STRING_TOO_LONG,
+    EXECUTE_INDEX_EXISTS,
+    EXECUTE_NOT_FOUND,
+    EXECUTE_AGGREGATE   // an aggregate select, which only aggregate() runs
+};
+
+enum PagerBackend
+{
+    PAGER_BUFFER_POOL,
+    PAGER_MMAP
+};
+
+// What a ? placeholder in a prepared statement stands for
+enum StatementParam
+{
+    PARAM_ID,            // insert: the row's id
+    PARAM_USERNAME,
+    PARAM_EMAIL,
+    PARAM_KEY,           // select where id = ?
+    PARAM_RANGE_START,   // select where id between ? and ...
+    PARAM_RANGE_END,
+    PARAM_LIMIT,
+    PARAM_OFFSET,
+    PARAM_VALUE          // select where username = ? / like ?
+};
+
+// What a select computes from the rows it selects, instead of the rows
+enum Aggregate
+{
+    AGGREGATE_NONE,
+    AGGREGATE_COUNT,   // select count(*)
+    AGGREGATE_MIN,     // select min(id)
+    AGGREGATE_MAX      // select max(id)
+};
+
+// Columns that can have a secondary index
+enum IndexColumn
+{
+    INDEX_USERNAME,
+    INDEX_EMAIL,
+    INDEX_COLUMN_COUNT
+};
+
+#define COLUMN_USERNAME_SIZE 32
+#define COLUMN_EMAIL_SIZE 255
+
+class Row
+{
+public:
+
+    uint32_t id;
+    char username[COLUMN_USERNAME_SIZE + 1];
+    char email[COLUMN_EMAIL_SIZE + 1];
+
+    Row()
+    {
+        id = 0;
+        username[0] = '\0';
+        email[0] = '\0';
+    }
+
+    Row(uint32_t id, const char *username, const char *email)
+    {
+        // Longer strings are cut to the column size
+        this->id = id;
+        strncpy(this->username, username, COLUMN_USERNAME_SIZE);
+        this->username[COLUMN_USERNAME_SIZE] = '\0';
+        strncpy(this->email, email, COLUMN_EMAIL_SIZE);
+        this->email[COLUMN_EMAIL_SIZE] = '\0';
+    }
+};
+
+class RowView
+{
+    /*
+    A row read in place from its serialized bytes in a leaf page:
+    the id, then username and email each as a one byte length and
+    that many bytes. Nothing is copied, so a view is only valid while
+    its page stays pinned; in scan and execute callbacks that is until
+    the callback returns. Use to_row() to keep a row longer.
+    */
+private:
+    const char *data;
+
+public:
+    explicit RowView(const void *data)
+    {
+        this->data = (const char *)data;
+    }
+
+    uint32_t id() const
+    {
+        uint32_t id;
+        memcpy(&id, data, sizeof(id));
+        return id;
+    }
+
+    std::string_view username() const
+    {
+        const char *field = data + sizeof(uint32_t);
+        return std::string_view(field + 1, (uint8_t)field[0]);
+    }
+
+    std::string_view email() const
+    {
+        const char *field = data + sizeof(uint32_t);
+        field += 1 + (uint8_t)field[0];
+        return std::string_view(field + 1, (uint8_t)field[0]);
+    }
+
+    Row to_row() const
+    {
+        Row row;
+        row.id = id();
+        std::string_view username = this->username();
+        std::string_view email = this->email();
+        memcpy(row.username, username.data(), username.size());
+        row.username[username.size()] = '\0';
+        memcpy(row.email, email.data(), email.size());
+        row.email[email.size()] = '\0';
+        return row;
+    }
+};
+
+class Statement
+{
+    /*
+    A parsed statement. Values written as ? are placeholders, numbered
+    from 0 in the order they appear, and are set with bind() before
+    each execution, so the text is parsed once and run many times.
+    Unbound placeholders hold 0 or an empty string.
+    */
+public:
+    StatementType type;
+    Row row_to_insert;
+    std::vector<Row> rows_to_insert;   // insert values (...), (...)
+
+    // select: keys in [range_start, range_end], at most limit rows
+    // after skipping the first offset
+    uint32_t range_start;
+    uint32_t range_end;
+    uint32_t limit;
+    uint32_t offset;
+
+    // select by username or email, and create index: the column, and
+    // the value it must equal or, for like, start with
+    IndexColumn column;
+    std::string value;
+    bool prefix;
+
+    // select count(*), min(id) or max(id), see Database::aggregate
+    Aggregate aggregate;
+
+    // The target of each placeholder, and for insert values its row
+    std::vector<std::pair<StatementParam, uint32_t>> params;
+
+    Statement()
+    {
+        range_start = 0;
+        range_end = UINT32_MAX;
+        limit = UINT32_MAX;
+        offset = 0;
+        column = INDEX_USERNAME;
+        prefix = false;
+        aggregate = AGGREGATE_NONE;
+    }
+
+    uint32_t param_count()
+    {
+        return params.size();
+    }
+
+    bool bind(uint32_t index, uint32_t value);
+    bool bind(uint32_t index, const std::string &value);
+};
+
+class Stats
+{
+    /*
+    What the engine did since the database was opened, and the shape of
+    the table's tree when the stats were taken. See Database::stats.
+    */
+public:
+    // Buffer pool. The mmap backend leaves caching to the kernel and
+    // counts neither hits nor misses
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+
+    // Page I/O on the database file, and bytes moved there and to the
+    // log. Compressed pages count their stored size
+    uint64_t pages_read;          // read-ahead included
+    uint64_t pages_read_ahead;
+    uint64_t pages_written;       // evictions, checkpoints and bulk loads
+    uint64_t pages_flushed;       // of those, written by checkpoints
+    uint64_t pages_logged;        // page images appended to the log
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+
+    // Tree changes
+    uint64_t leaf_splits;
+    uint64_t internal_splits;
+    uint64_t root_splits;         // each added a level
+
+    // Work done by statements: rows read from leaves by lookups and
+    // scans, and time spent waiting on reads, writes and syncs while
+    // timing is on, see Database::set_timing
+    uint64_t rows_examined;
+    uint64_t io_nanoseconds;
+
+    // Tree shape
+    uint32_t tree_height;         // levels, 1 for a root leaf
+    uint32_t page_count;          // pages in the file, free ones included
+    uint32_t leaf_count;
+    uint64_t row_count;
+    double leaf_fill_percent;     // average share of leaf cell space in use
+
+    Stats()
+    {
+        memset((void *)this, 0, sizeof(*this));
+    }
+};
+
+// Parse one statement of the query language into statement
+PrepareResult prepare_statement(const std::string &text, Statement &statement);
+
+// Pick the node key search, see key_lower_bound; false if unsupported
+bool select_key_search(const std::string &name);
+
+class Table;
+
+class Database
+{
+    /*
+    The embeddable engine: one table of rows keyed by id, stored in a
+    B+ tree in the given file. Every call that changes the table
+    commits before it returns. Fatal I/O errors and corrupt files end
+    the process, as they do in the REPL.
+
+    A Database can be shared by threads. Lookups, scans and finds run
+    side by side, and so do inserts of a row that fits its leaf into a
+    table without indexes, latching pages on the way down. Any other
+    change has the table to itself. Changes wait for their log sync
+    after letting go, so concurrent commits share syncs. A callback
+    runs with the table held and must not call back in.
+    */
+private:
+    Table *table;
+
+public:
+    Database(const char *filename, uint32_t pool_size = DEFAULT_POOL_SIZE,
+             PagerBackend backend = PAGER_BUFFER_POOL, bool compress = false);
+    ~Database();
+
+    ExecuteResult put(uint32_t id, const std::string &username, const std::string &email);
+    ExecuteResult put_many(std::vector<Row> &rows);
+    ExecuteResult update(uint32_t id, const std::string &username, const std::string &email);
+    // Delete the rows with ids in [low, high]; returns how many there were
+    uint32_t remove(uint32_t low, uint32_t high);
+    bool get(uint32_t id, Row &row);
+    // Rows with ids in [low, high] in id order until callback returns false
+    void scan(uint32_t low, uint32_t high, std::function<bool(const RowView &)> callback);
+    // Aggregate selects have no rows to call back with and are refused
+    // with EXECUTE_AGGREGATE; run them with aggregate()
+    ExecuteResult execute(Statement &statement, std::function<bool(const RowView &)> callback);
+    // The value of an aggregate select, false for min or max of no
+    // rows. Counts by id come from the tree without reading the rows;
+    // other large selects are scanned by several threads at once
+    bool aggregate(Statement &statement, uint64_t &value);
+
+    // Secondary indexes are kept up to date by every insert. find uses
+    // one if the column has it and scans the table otherwise
+    ExecuteResult create_index(IndexColumn column);
+    void find(IndexColumn column, const std::string &value, bool prefix,
+              std::function<bool(const RowView &)> callback);
+
+    bool is_empty();
+    bool import_file(const std::string &filename, uint32_t fill_percent,
+                     uint32_t &num_rows, std::string &error);
+    void checkpoint();
+    // Counters are always kept; the tree shape costs one pass over it
+    void stats(Stats &stats);
+    // Only the counters, cheap enough to take around every statement
+    void counters(Stats &stats);
+    // Time page I/O into Stats::io_nanoseconds; off, it costs a flag check
+    void set_timing(bool timing);
+    // Move live pages to the front of the file and cut off the rest;
+    // returns the number of pages removed
+    uint32_t vacuum();
+    void print_tree();
+    static void print_constants();
+};
+
+#endif